@@ -12,6 +12,18 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To overlap several transfers, call bsubmit for each,
+//     then bkick once, then bwait for each.
+// * To read several consecutive blocks, call breadn; the
+//     missing ones go to the disk together.
+// * To start reading blocks that will be wanted soon, call
+//     breadahead for each, then bkick. A later bread waits
+//     for the read instead of starting another.
+// * To hold data that has no disk block yet, call bdelay;
+//     bundelay gives the buffer back.
+//
+// Requests go to the driver that bdevsw[dev] names: the
+// virtio disks (through the I/O scheduler), or the ramdisk.
 
 
 #include "types.h"
@@ -22,6 +34,7 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
 
 struct {
   struct spinlock lock;
@@ -31,8 +44,13 @@ struct {
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+
+  uint64 nahead;  // blocks read ahead
+  int ndelay;     // buffers handed out by bdelay()
 } bcache;
 
+struct bdevsw bdevsw[NBDEV];
+
 void
 binit(void)
 {
@@ -64,7 +82,7 @@ bget(uint dev, uint blockno)
 
   // Is the block already cached?
   for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+    if(b->dev == dev && b->blockno == blockno && !b->delay){
       b->refcnt++;
       release(&bcache.lock);
       acquiresleep(&b->lock);
@@ -73,12 +91,14 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
+  // Recycle the least recently used (LRU) unused buffer,
+  // skipping any still being read ahead.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
+    if(b->refcnt == 0 && !b->disk) {
       b->dev = dev;
       b->blockno = blockno;
       b->valid = 0;
+      b->ahead = 0;
       b->refcnt = 1;
       release(&bcache.lock);
       acquiresleep(&b->lock);
@@ -96,19 +116,205 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    if(!b->ahead){
+      bsubmit(b, 0);
+      bkick();
+    }
+    bwait(b);
+    b->ahead = 0;
+    b->valid = 1;
+  }
+  return b;
+}
+
+// Return a locked buf for a block that the caller is going
+// to overwrite completely, without reading it.
+struct buf*
+bgetnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(!b->valid){
+    if(b->ahead)
+      bwait(b);
+    b->ahead = 0;
     b->valid = 1;
   }
   return b;
 }
 
+// Return locked bufs in b[] for the n blocks starting at
+// blockno. Queues all the reads before kicking the disk, so
+// the scheduler can merge them into one request.
+void
+breadn(uint dev, uint blockno, int n, struct buf **b)
+{
+  int i, kick;
+
+  kick = 0;
+  for(i = 0; i < n; i++){
+    b[i] = bget(dev, blockno + i);
+    if(!b[i]->valid && !b[i]->ahead){
+      bsubmit(b[i], 0);
+      kick = 1;
+    }
+  }
+  if(kick)
+    bkick();
+  for(i = 0; i < n; i++){
+    if(!b[i]->valid){
+      bwait(b[i]);
+      b[i]->ahead = 0;
+      b[i]->valid = 1;
+    }
+  }
+}
+
+// Start reading the indicated block into the cache, unless
+// it is already there or few buffers are free. Doesn't wait,
+// and doesn't lock the buffer: the disk owns it until the
+// read is done, bget() won't recycle it before then, and
+// bread() waits for it. Call bkick() to start the reads.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b, *victim;
+  int nfree;
+
+  acquire(&bcache.lock);
+  victim = 0;
+  nfree = 0;
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno && !b->delay){
+      release(&bcache.lock);
+      return;
+    }
+    if(b->refcnt == 0 && !b->disk){
+      victim = b;  // least recently used so far
+      nfree++;
+    }
+  }
+  // leave some for bget(), which can't wait for a read
+  // ahead to finish.
+  if(nfree > NBUF/4){
+    b = victim;
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->ahead = 1;
+    // queue it before anyone can find it, so that
+    // bread() sees the disk owns it.
+    bsubmit(b, 0);
+    bcache.nahead++;
+    // most recent, so the rest of the window
+    // doesn't recycle it.
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    b->next = bcache.head.next;
+    b->prev = &bcache.head;
+    bcache.head.next->prev = b;
+    bcache.head.next = b;
+  }
+  release(&bcache.lock);
+}
+
+// Return a zeroed buffer for data that has no disk block
+// yet, or 0 if max (or NDELAYBUF) such buffers are out
+// already. bget() never finds or recycles it, and it isn't
+// locked: it belongs to the caller until bundelay().
+struct buf*
+bdelay(int max)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  if(bcache.ndelay >= max || bcache.ndelay >= NDELAYBUF){
+    release(&bcache.lock);
+    return 0;
+  }
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if(b->refcnt == 0 && !b->disk){
+      b->delay = 1;
+      b->valid = 0;
+      b->ahead = 0;
+      b->refcnt = 1;
+      bcache.ndelay++;
+      release(&bcache.lock);
+      memset(b->data, 0, BSIZE);
+      return b;
+    }
+  }
+  panic("bdelay: no buffers");
+}
+
+// Give back a buffer from bdelay(). It holds no block,
+// so it is the first to be recycled.
+void
+bundelay(struct buf *b)
+{
+  acquire(&bcache.lock);
+  if(!b->delay)
+    panic("bundelay");
+  b->delay = 0;
+  b->refcnt--;
+  bcache.ndelay--;
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  b->next = &bcache.head;
+  b->prev = bcache.head.prev;
+  bcache.head.prev->next = b;
+  bcache.head.prev = b;
+  release(&bcache.lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bsubmit(b, 1);
+  bkick();
+  bwait(b);
+}
+
+// Is there a block device dev?
+int
+bdevpresent(uint dev)
+{
+  return dev < NBDEV && bdevsw[dev].submit != 0;
+}
+
+// Queue an asynchronous read (write=0) or write of b.
+// The caller must own b -- hold its lock, or have a private
+// buf outside the cache -- until bwait(b) returns.
+// Disk requests wait in the I/O scheduler (iosched.c) until
+// the driver has room for them; bkick() makes sure they
+// start. The ramdisk does the copy at once.
+void
+bsubmit(struct buf *b, int write)
+{
+  if(!bdevpresent(b->dev))
+    panic("bsubmit: no device");
+  bdevsw[b->dev].submit(b, write);
+}
+
+// Send all queued requests to the disks.
+void
+bkick(void)
+{
+  for(uint dev = 0; dev < NBDEV; dev++)
+    if(bdevsw[dev].kick)
+      bdevsw[dev].kick(dev);
+}
+
+// Wait for a request started by bsubmit() to finish.
+void
+bwait(struct buf *b)
+{
+  if(bdevsw[b->dev].wait)
+    bdevsw[b->dev].wait(b);
 }
 
 // Release a locked buffer.
@@ -150,4 +356,13 @@ bunpin(struct buf *b) {
   release(&bcache.lock);
 }
 
+// report buffer cache counters.
+void
+bstats(struct kstat *st)
+{
+  acquire(&bcache.lock);
+  st->readahead = bcache.nahead;
+  release(&bcache.lock);
+}
+
 
@@ -1,12 +1,30 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ahead;   // read ahead: data is valid once disk is 0
+  int write;   // disk request is a write
+  int delay;   // holds a block with no disk address yet; see bdelay()
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *qnext; // disk queue: sort order, then request run
+  struct buf *qprev;
+  struct buf *fnext; // disk queue: arrival order
+  struct buf *fprev;
+  uint qtime;        // ticks when queued for the disk
+  uint64 stime;      // r_time() when sent to the disk
   uchar data[BSIZE];
 };
 
+
+// map block device number to driver functions.
+struct bdevsw {
+  void (*submit)(struct buf*, int);  // queue, or do, a read or write
+  void (*kick)(uint);                // start dev's queued requests; may be 0
+  void (*wait)(struct buf*);         // wait for b's request; may be 0
+};
+
+extern struct bdevsw bdevsw[];
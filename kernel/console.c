@@ -17,6 +17,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "epoll.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
@@ -50,6 +51,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct epitem *watch;  // epoll items watching the console
 } cons;
 
 //
@@ -170,6 +173,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        epoll_notify(cons.watch, EPOLLIN);
       }
     }
     break;
@@ -178,6 +182,26 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+//
+// epoll registration for the console.
+// output never blocks, so the console is always writable.
+//
+int
+consolewatch(struct epitem *it, int add)
+{
+  int ev = EPOLLOUT;
+
+  acquire(&cons.lock);
+  if(add)
+    epoll_link(&cons.watch, it);
+  else
+    epoll_unlink(&cons.watch, it);
+  if(cons.r != cons.w)
+    ev |= EPOLLIN;
+  release(&cons.lock);
+  return ev;
+}
+
 void
 consoleinit(void)
 {
@@ -189,4 +213,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].watch = consolewatch;
 }
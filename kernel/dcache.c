@@ -0,0 +1,187 @@
+//
+// Directory entry cache: remembers what dirlookup() found,
+// keyed by (dev, directory inum, name), so that namex() can
+// walk a path without locking and reading every directory.
+//
+// An entry with inum 0 is negative: the name is known not
+// to be in the directory.
+//
+// Entries are filled in by dirlookup(), which holds the
+// directory locked, and changed by dirlink() and unlink(),
+// which do too; so an entry always agrees with the directory
+// as seen by whoever holds its lock. When a directory inode
+// is freed its entries are purged.
+//
+// The cache is a hash table of small buckets. A writer holds
+// the bucket's lock and makes seq odd while it changes the
+// bucket. dcache_lookup() takes no lock: it reads seq, looks,
+// and checks that seq has not changed, retrying if it has.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "kstat.h"
+
+#define NDBUCKET 128
+#define DCWAYS     4   // entries per bucket
+
+struct dentry {
+  uint dev;
+  uint dinum;          // directory; 0 if the entry is free
+  uint inum;           // 0 if the name is not there
+  char name[DIRSIZ];
+};
+
+struct dbucket {
+  struct spinlock lock;
+  volatile uint seq;   // odd while being changed
+  uint hand;           // next way to replace
+  struct dentry e[DCWAYS];
+};
+
+struct {
+  struct dbucket b[NDBUCKET];
+  uint64 hits;
+  uint64 neghits;
+  uint64 misses;
+} dcache;
+
+void
+dcacheinit(void)
+{
+  for(int i = 0; i < NDBUCKET; i++)
+    initlock(&dcache.b[i].lock, "dcache");
+}
+
+static struct dbucket*
+dhash(uint dev, uint dinum, char *name)
+{
+  uint h = dev * 31 + dinum;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.b[h % NDBUCKET];
+}
+
+static struct dentry*
+dfind(struct dbucket *b, uint dev, uint dinum, char *name)
+{
+  struct dentry *e;
+
+  for(e = b->e; e < b->e + DCWAYS; e++)
+    if(e->dinum == dinum && e->dev == dev && namecmp(e->name, name) == 0)
+      return e;
+  return 0;
+}
+
+static void
+wbegin(struct dbucket *b)
+{
+  acquire(&b->lock);
+  b->seq++;
+  __sync_synchronize();
+}
+
+static void
+wend(struct dbucket *b)
+{
+  __sync_synchronize();
+  b->seq++;
+  release(&b->lock);
+}
+
+// Look name up in directory dp, which the caller holds a
+// reference to but need not have locked. Returns 1 and sets
+// *ipp to a referenced inode, or to 0 if the name is known
+// to be absent; returns 0 if the cache doesn't know.
+int
+dcache_lookup(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dbucket *b = dhash(dp->dev, dp->inum, name);
+  struct dentry *e;
+  struct inode *ip;
+  uint seq, inum;
+
+  for(;;){
+    seq = b->seq;
+    __sync_synchronize();
+    if(seq & 1)
+      continue;
+    e = dfind(b, dp->dev, dp->inum, name);
+    inum = e ? e->inum : 0;
+    // take the reference before checking seq, so that the
+    // inode can't be freed and reused if the entry was current.
+    ip = inum ? iget(dp->dev, inum) : 0;
+    __sync_synchronize();
+    if(b->seq == seq)
+      break;
+    if(ip)
+      iput(ip);
+  }
+
+  if(e == 0){
+    __sync_fetch_and_add(&dcache.misses, 1);
+    return 0;
+  }
+  if(ip)
+    __sync_fetch_and_add(&dcache.hits, 1);
+  else
+    __sync_fetch_and_add(&dcache.neghits, 1);
+  *ipp = ip;
+  return 1;
+}
+
+// Record that name in dp refers to inum (0: absent).
+// Caller holds dp locked.
+void
+dcache_enter(struct inode *dp, char *name, uint inum)
+{
+  struct dbucket *b = dhash(dp->dev, dp->inum, name);
+  struct dentry *e;
+
+  wbegin(b);
+  if((e = dfind(b, dp->dev, dp->inum, name)) == 0){
+    for(e = b->e; e < b->e + DCWAYS; e++)
+      if(e->dinum == 0)
+        break;
+    if(e == b->e + DCWAYS)
+      e = &b->e[b->hand++ % DCWAYS];
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+  }
+  e->inum = inum;
+  wend(b);
+}
+
+// Forget every entry in directory (dev, dinum),
+// which is being freed.
+void
+dcache_purge(uint dev, uint dinum)
+{
+  struct dbucket *b;
+  struct dentry *e;
+
+  for(b = dcache.b; b < dcache.b + NDBUCKET; b++){
+    wbegin(b);
+    for(e = b->e; e < b->e + DCWAYS; e++)
+      if(e->dinum == dinum && e->dev == dev)
+        e->dinum = 0;
+    wend(b);
+  }
+}
+
+// report dcache counters.
+void
+dcache_stats(struct kstat *st)
+{
+  st->dcachehits = dcache.hits;
+  st->dcacheneg = dcache.neghits;
+  st->dcachemisses = dcache.misses;
+}
@@ -1,7 +1,12 @@
 struct buf;
 struct context;
+struct epitem;
+struct epoll;
+struct epoll_event;
 struct file;
 struct inode;
+struct iovec;
+struct kstat;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -12,16 +17,44 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadn(uint, uint, int, struct buf**);
+struct buf*     bgetnew(uint, uint);
+struct buf*     bdelay(int);
+void            bundelay(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bsubmit(struct buf*, int);
+void            bkick(void);
+void            bwait(struct buf*);
+int             bdevpresent(uint);
+void            breadahead(uint, uint);
+void            bstats(struct kstat*);
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(struct inode*, char*, struct inode**);
+void            dcache_enter(struct inode*, char*, uint);
+void            dcache_purge(uint, uint);
+void            dcache_stats(struct kstat*);
+
+// epoll.c
+void            epollinit(void);
+int             epollalloc(struct file**);
+void            epollclose(struct epoll*);
+int             epollctl(struct epoll*, int, struct file*, struct epoll_event*);
+int             epollwait(struct epoll*, uint64, int, int);
+void            epoll_fileclose(struct file*);
+void            epoll_link(struct epitem**, struct epitem*);
+void            epoll_unlink(struct epitem**, struct epitem*);
+void            epoll_notify(struct epitem*, uint);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -31,20 +64,30 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             fileseek(struct file*, int, int);
 int             filestat(struct file*, uint64 addr);
+int             filetruncate(struct file*, uint);
+int             filesync(struct file*);
+int             filefallocate(struct file*, int, uint, uint);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
 
 // fs.c
-void            fsinit(int);
+int             fsinit(int);
+uint            bmap_range(struct inode*, uint, uint, uint*, int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
+void            ireadahead(struct inode*, uint, uint);
 struct inode*   idup(struct inode*);
+struct inode*   iget(uint, uint);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
+void            iputdeferred(void);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
@@ -53,11 +96,31 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             itruncate(struct inode*, uint);
+void            itrimwindow(struct inode*);
+int             iprealloc(struct inode*, uint, uint);
+void            iflush(struct inode*);
+int             mount(struct inode*, uint);
+int             ismount(struct inode*);
+
+// tmpfs.c
+void            tmpfsinit(void);
+struct inode*   tmp_ialloc(short);
+void            tmp_iload(struct inode*);
+void            tmp_iupdate(struct inode*);
+int             tmp_itruncate(struct inode*, uint);
+int             tmp_iprealloc(struct inode*, uint, uint);
+int             tmp_readi(struct inode*, int, uint64, uint, uint);
+int             tmp_writei(struct inode*, int, uint64, uint, uint);
 
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+
+// iosched.c
+void            ioschedinit(void);
+void            iosched_add(struct buf*, int);
+struct buf*     iosched_next(uint, int);
+int             iosched_select(int);
 
 // kalloc.c
 void*           kalloc(void);
@@ -65,16 +128,27 @@ void            kfree(void *);
 void            kinit(void);
 
 // log.c
-void            initlog(int, struct superblock*);
+void            loginit(void);
+int             initlog(int, struct superblock*);
 void            log_write(struct buf*);
-void            begin_op(void);
-void            end_op(void);
+void            begin_op(uint);
+void            end_op(uint);
+void            begin_opn(uint, int);
+void            end_opn(uint, int);
+int             log_joined(uint);
+int             log_inop(void);
+int             log_opmax(void);
+void            log_stats(struct kstat*);
+int             log_interval(int);
+int             log_seq(uint);
+void            log_force(uint, int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipewatch(struct pipe*, struct epitem*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -100,6 +174,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(void (*)(void*), void*, char*);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -182,8 +257,11 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+void            virtio_disk_kick(uint);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_intr(int);
+void            virtio_disk_stats(struct kstat*);
+int             virtio_disk_poll(int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
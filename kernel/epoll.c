@@ -0,0 +1,508 @@
+//
+// epoll: a persistent interest set with edge-triggered notification.
+//
+// An epoll instance is a file (FD_EPOLL). epoll_ctl() adds
+// (file, events) items to it; each item is also linked onto
+// the watch list of the object behind the file (a pipe, or
+// the console). When that object wakes up its own sleepers
+// it calls epoll_notify(), which appends the item to the
+// instance's ready list. epoll_wait() only ever looks at the
+// ready list, so its cost is proportional to the number of
+// ready items, not the number registered.
+//
+// Notification is edge-triggered: an item is queued once per
+// burst of activity, and epoll_wait() dequeues it. A newly
+// added item is queued right away if its file is already ready.
+//
+// Items do not hold a reference to their file. When the last
+// reference to a watched file goes away, fileclose() calls
+// epoll_fileclose() to drop its items.
+//
+// Each item is on two lists: its instance's (ep->items) and
+// its file's (f->epitems), so that epoll_ctl() and closing
+// either side only look at the items involved.
+//
+// Locking: ep->ctl protects ep's item list and the fields of
+// its items that epoll_ctl() sets; then epoll_lock protects
+// the files' item lists and the free items; then the watched
+// object's lock protects its watch list; then ep->lock
+// protects the ready list. epoll_lock is only held to link or
+// unlink an item, so instances don't hold each other up.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "epoll.h"
+
+#define EPBATCH 16  // events copied out per trip through ep->lock
+
+struct epoll {
+  struct spinlock lock;
+  struct spinlock ctl;
+  int ref;                // allocated?
+  struct epitem *items;   // registered items; ctl
+  struct epitem *rdhead;  // ready list, oldest first
+  struct epitem *rdtail;
+};
+
+struct epitem {
+  struct epoll *ep;       // 0 if free
+  struct file *f;         // watched file
+  uint events;            // events asked for
+  uint mask;              // events that can fire on this file
+  uint64 data;
+  uint revents;           // pending events; ep->lock
+  int ready;              // on ep's ready list; ep->lock
+  struct epitem *rdnext;  // ep's ready list; ep->lock
+  struct epitem *wnext;   // watched object's list; object's lock
+  struct epitem *enext;   // ep->items, or the free list
+  struct epitem *eprev;
+  struct epitem *fnext;   // f->epitems; epoll_lock
+  struct epitem *fprev;
+};
+
+struct spinlock epoll_lock;
+struct epoll epolls[NEPOLL];
+struct epitem epitems[NEPITEM];
+struct epitem *epfree;  // unused items; epoll_lock
+
+void
+epollinit(void)
+{
+  initlock(&epoll_lock, "epoll");
+  for(int i = 0; i < NEPOLL; i++){
+    initlock(&epolls[i].lock, "epollrd");
+    initlock(&epolls[i].ctl, "epollctl");
+  }
+  for(int i = 0; i < NEPITEM; i++){
+    epitems[i].enext = epfree;
+    epfree = &epitems[i];
+  }
+}
+
+// Link it onto a watch list. Caller holds the list owner's lock.
+void
+epoll_link(struct epitem **list, struct epitem *it)
+{
+  it->wnext = *list;
+  *list = it;
+}
+
+// Remove it from a watch list. Caller holds the list owner's lock.
+void
+epoll_unlink(struct epitem **list, struct epitem *it)
+{
+  struct epitem **pp;
+
+  for(pp = list; *pp; pp = &(*pp)->wnext){
+    if(*pp == it){
+      *pp = it->wnext;
+      it->wnext = 0;
+      return;
+    }
+  }
+  panic("epoll_unlink");
+}
+
+// Put it on its ready list with events ev.
+// Caller holds it->ep->lock.
+static void
+enqueue(struct epitem *it, uint ev)
+{
+  struct epoll *ep = it->ep;
+
+  it->revents |= ev;
+  if(it->ready)
+    return;
+  it->ready = 1;
+  it->rdnext = 0;
+  if(ep->rdtail)
+    ep->rdtail->rdnext = it;
+  else
+    ep->rdhead = it;
+  ep->rdtail = it;
+  wakeup(ep);
+}
+
+// Take it off its ready list, if it is there.
+// Caller holds it->ep->lock.
+static void
+dequeue(struct epitem *it)
+{
+  struct epoll *ep = it->ep;
+  struct epitem **pp, *prev;
+
+  if(!it->ready)
+    return;
+  prev = 0;
+  for(pp = &ep->rdhead; *pp; pp = &(*pp)->rdnext){
+    if(*pp == it){
+      *pp = it->rdnext;
+      if(ep->rdtail == it)
+        ep->rdtail = prev;
+      break;
+    }
+    prev = *pp;
+  }
+  it->ready = 0;
+  it->revents = 0;
+}
+
+// Called by a watched object, with its lock held, when
+// events ev have happened. Queues every interested item.
+void
+epoll_notify(struct epitem *list, uint ev)
+{
+  struct epitem *it;
+  uint e;
+
+  for(it = list; it; it = it->wnext){
+    if((e = ev & it->mask) == 0)
+      continue;
+    acquire(&it->ep->lock);
+    enqueue(it, e);
+    release(&it->ep->lock);
+  }
+}
+
+// Add (add=1) or remove (add=0) it on the watch list of
+// the object behind it->f. Returns the events currently
+// pending on the file, or -1 if the file can't be watched.
+static int
+watch(struct epitem *it, int add)
+{
+  struct file *f = it->f;
+
+  if(f->type == FD_PIPE)
+    return pipewatch(f->pipe, it, add);
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+     devsw[f->major].watch)
+    return devsw[f->major].watch(it, add);
+  return -1;
+}
+
+// Link it, a new item for (ep, f), onto ep's and f's lists.
+// Caller holds ep->ctl and epoll_lock.
+static void
+itemlink(struct epitem *it)
+{
+  struct epoll *ep = it->ep;
+  struct file *f = it->f;
+
+  it->eprev = 0;
+  it->enext = ep->items;
+  if(ep->items)
+    ep->items->eprev = it;
+  ep->items = it;
+  it->fprev = 0;
+  it->fnext = f->epitems;
+  if(f->epitems)
+    f->epitems->fprev = it;
+  f->epitems = it;
+}
+
+// Take it off its file's list. Caller holds epoll_lock.
+static void
+itemunlinkf(struct epitem *it)
+{
+  if(it->fprev)
+    it->fprev->fnext = it->fnext;
+  else
+    it->f->epitems = it->fnext;
+  if(it->fnext)
+    it->fnext->fprev = it->fprev;
+  it->fnext = it->fprev = 0;
+}
+
+// Stop watching and free it, which is already off its
+// file's list. Caller holds it->ep->ctl.
+static void
+itemfree(struct epitem *it)
+{
+  struct epoll *ep = it->ep;
+
+  watch(it, 0);
+  acquire(&ep->lock);
+  dequeue(it);
+  release(&ep->lock);
+  if(it->eprev)
+    it->eprev->enext = it->enext;
+  else
+    ep->items = it->enext;
+  if(it->enext)
+    it->enext->eprev = it->eprev;
+  it->f = 0;
+  it->ep = 0;
+  it->eprev = 0;
+  acquire(&epoll_lock);
+  it->enext = epfree;
+  epfree = it;
+  release(&epoll_lock);
+}
+
+// ep's item for f, or 0. A file has few items, so this
+// looks through f's rather than ep's.
+// Caller holds ep->ctl.
+static struct epitem*
+itemfind(struct epoll *ep, struct file *f)
+{
+  struct epitem *it;
+
+  acquire(&epoll_lock);
+  for(it = f->epitems; it; it = it->fnext)
+    if(it->ep == ep)
+      break;
+  release(&epoll_lock);
+  return it;
+}
+
+int
+epollalloc(struct file **pf)
+{
+  struct epoll *ep;
+  struct file *f;
+
+  if((f = filealloc()) == 0)
+    return -1;
+  acquire(&epoll_lock);
+  for(ep = epolls; ep < epolls + NEPOLL; ep++){
+    if(ep->ref == 0){
+      ep->ref = 1;
+      ep->items = 0;
+      ep->rdhead = ep->rdtail = 0;
+      release(&epoll_lock);
+      f->type = FD_EPOLL;
+      f->readable = 1;
+      f->writable = 0;
+      f->ep = ep;
+      *pf = f;
+      return 0;
+    }
+  }
+  release(&epoll_lock);
+  fileclose(f);
+  return -1;
+}
+
+// Last reference to the epoll file is gone.
+void
+epollclose(struct epoll *ep)
+{
+  struct epitem *it;
+
+  acquire(&ep->ctl);
+  while((it = ep->items) != 0){
+    acquire(&epoll_lock);
+    itemunlinkf(it);
+    release(&epoll_lock);
+    itemfree(it);
+  }
+  release(&ep->ctl);
+  acquire(&epoll_lock);
+  ep->ref = 0;
+  release(&epoll_lock);
+}
+
+// Last reference to f is gone; forget every item watching it.
+// No epoll_ctl() can add one now, but epollclose() may be
+// freeing them too: an item found on f's list is only taken
+// off it by whoever holds its instance's ctl lock.
+void
+epoll_fileclose(struct file *f)
+{
+  struct epitem *it;
+  struct epoll *ep;
+
+  for(;;){
+    acquire(&epoll_lock);
+    if((it = f->epitems) == 0){
+      release(&epoll_lock);
+      return;
+    }
+    ep = it->ep;
+    release(&epoll_lock);
+
+    acquire(&ep->ctl);
+    acquire(&epoll_lock);
+    if(f->epitems == it && it->ep == ep){
+      itemunlinkf(it);
+      release(&epoll_lock);
+      itemfree(it);
+    } else {
+      release(&epoll_lock);  // epollclose() got there first
+    }
+    release(&ep->ctl);
+  }
+}
+
+// Events that can ever fire for f.
+static uint
+filemask(struct file *f, uint events)
+{
+  uint m = events & (EPOLLIN|EPOLLOUT);
+
+  if(!f->readable)
+    m &= ~EPOLLIN;
+  if(!f->writable)
+    m &= ~EPOLLOUT;
+  if(f->readable)
+    m |= EPOLLHUP;
+  if(f->writable)
+    m |= EPOLLERR;
+  return m;
+}
+
+int
+epollctl(struct epoll *ep, int op, struct file *f, struct epoll_event *ev)
+{
+  struct epitem *it;
+  int ready;
+
+  if(f->type == FD_EPOLL)
+    return -1;
+
+  acquire(&ep->ctl);
+  it = itemfind(ep, f);
+  switch(op){
+  case EPOLL_CTL_ADD:
+    if(it != 0)
+      goto bad;
+    acquire(&epoll_lock);
+    if((it = epfree) == 0){
+      release(&epoll_lock);
+      goto bad;
+    }
+    epfree = it->enext;
+    it->ep = ep;
+    it->f = f;
+    it->events = ev->events;
+    it->mask = filemask(f, ev->events);
+    it->data = ev->data;
+    it->revents = 0;
+    it->ready = 0;
+    itemlink(it);
+    release(&epoll_lock);
+    if((ready = watch(it, 1)) < 0){
+      acquire(&epoll_lock);
+      itemunlinkf(it);
+      release(&epoll_lock);
+      itemfree(it);
+      goto bad;
+    }
+    break;
+  case EPOLL_CTL_MOD:
+    if(it == 0)
+      goto bad;
+    // re-link so the new mask is checked against
+    // the file's state under the object's lock.
+    watch(it, 0);
+    acquire(&ep->lock);
+    dequeue(it);
+    it->events = ev->events;
+    it->mask = filemask(f, ev->events);
+    it->data = ev->data;
+    release(&ep->lock);
+    ready = watch(it, 1);
+    break;
+  case EPOLL_CTL_DEL:
+    if(it == 0)
+      goto bad;
+    acquire(&epoll_lock);
+    itemunlinkf(it);
+    release(&epoll_lock);
+    itemfree(it);
+    release(&ep->ctl);
+    return 0;
+  default:
+    goto bad;
+  }
+
+  // edge for the state the file is already in.
+  if(ready & it->mask){
+    acquire(&ep->lock);
+    enqueue(it, ready & it->mask);
+    release(&ep->lock);
+  }
+  release(&ep->ctl);
+  return 0;
+
+ bad:
+  release(&ep->ctl);
+  return -1;
+}
+
+// Wait for events on ep and copy up to maxevents of them
+// to the user array at addr. timeout is in clock ticks;
+// -1 waits forever, 0 just polls. A timed wait notices new
+// events at the next clock tick.
+// Returns the number of events, or -1.
+int
+epollwait(struct epoll *ep, uint64 addr, int maxevents, int timeout)
+{
+  struct proc *p = myproc();
+  struct epoll_event evs[EPBATCH];
+  struct epitem *it;
+  uint ticks0;
+  int n, i;
+
+  if(maxevents <= 0)
+    return -1;
+
+  acquire(&tickslock);
+  ticks0 = ticks;
+  release(&tickslock);
+
+  acquire(&ep->lock);
+  while(ep->rdhead == 0){
+    if(killed(p)){
+      release(&ep->lock);
+      return -1;
+    }
+    if(timeout == 0){
+      release(&ep->lock);
+      return 0;
+    }
+    if(timeout < 0){
+      sleep(ep, &ep->lock);
+      continue;
+    }
+    release(&ep->lock);
+    acquire(&tickslock);
+    if(ticks - ticks0 >= timeout){
+      release(&tickslock);
+      return 0;
+    }
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+    acquire(&ep->lock);
+  }
+
+  n = 0;
+  while(n < maxevents && ep->rdhead){
+    for(i = 0; i < EPBATCH && n + i < maxevents && ep->rdhead; i++){
+      it = ep->rdhead;
+      ep->rdhead = it->rdnext;
+      if(ep->rdhead == 0)
+        ep->rdtail = 0;
+      evs[i].events = it->revents;
+      evs[i].data = it->data;
+      it->ready = 0;
+      it->revents = 0;
+    }
+    release(&ep->lock);
+    if(copyout(p->pagetable, addr + n*sizeof(evs[0]), (char*)evs,
+               i*sizeof(evs[0])) < 0)
+      return -1;
+    n += i;
+    acquire(&ep->lock);
+  }
+  release(&ep->lock);
+  return n;
+}
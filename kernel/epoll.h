@@ -0,0 +1,16 @@
+// epoll interface.
+// Both the kernel and user programs use this header file.
+
+#define EPOLLIN   0x001  // data to read (or end of file)
+#define EPOLLOUT  0x004  // room to write
+#define EPOLLERR  0x008  // write end: reader has gone away
+#define EPOLLHUP  0x010  // read end: writer has gone away
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+struct epoll_event {
+  uint events;   // EPOLLIN, EPOLLOUT, ...
+  uint64 data;   // returned unchanged by epoll_wait()
+};
@@ -31,12 +31,10 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
-  begin_op();
-
-  if((ip = namei(path)) == 0){
-    end_op();
+  // exec only reads, so needs no transaction; if the last
+  // link to ip goes meanwhile, iput() frees it in one of its own.
+  if((ip = namei(path)) == 0)
     return -1;
-  }
   ilock(ip);
 
   // Check ELF header
@@ -69,7 +67,6 @@ exec(char *path, char **argv)
       goto bad;
   }
   iunlockput(ip);
-  end_op();
   ip = 0;
 
   p = myproc();
@@ -133,10 +130,8 @@ exec(char *path, char **argv)
  bad:
   if(pagetable)
     proc_freepagetable(pagetable, sz);
-  if(ip){
+  if(ip)
     iunlockput(ip);
-    end_op();
-  }
   return -1;
 }
 
@@ -12,6 +12,14 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "iovec.h"
+#include "fcntl.h"
+
+// log blocks a writei() may dirty besides its data blocks:
+// i-node, up to six extent tree (or indirect) blocks,
+// two bitmap blocks, and one more data block when
+// the write isn't block-aligned.
+#define WRITESLOP 10
 
 struct devsw devsw[NDEV];
 struct {
@@ -55,11 +63,24 @@ filedup(struct file *f)
   return f;
 }
 
+// Give ip's blocks awaiting allocation their disk blocks
+// (see iflush()), in a transaction of their own.
+static void
+flushdelay(struct inode *ip)
+{
+  begin_opn(ip->dev, NDELAY + WRITESLOP);
+  ilock(ip);
+  iflush(ip);
+  iunlock(ip);
+  end_opn(ip->dev, NDELAY + WRITESLOP);
+}
+
 // Close file f.  (Decrement ref count, close when reaches 0.)
 void
 fileclose(struct file *f)
 {
   struct file ff;
+  uint dev;
 
   acquire(&ftable.lock);
   if(f->ref < 1)
@@ -68,6 +89,8 @@ fileclose(struct file *f)
     release(&ftable.lock);
     return;
   }
+  if(f->type == FD_PIPE || f->type == FD_DEVICE)
+    epoll_fileclose(f);
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
@@ -75,10 +98,17 @@ fileclose(struct file *f)
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
+  } else if(ff.type == FD_EPOLL){
+    epollclose(ff.ep);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op();
+    if(ff.type == FD_INODE && ff.writable && ff.ip->ndelay > 0)
+      flushdelay(ff.ip);
+    if(ff.type == FD_INODE && ff.writable)
+      itrimwindow(ff.ip);
+    dev = ff.ip->dev;  // ff.ip may be reused once put
+    begin_op(dev);
     iput(ff.ip);
-    end_op();
+    end_op(dev);
   }
 }
 
@@ -101,27 +131,184 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+#define RAMIN 4  // first readahead window, in blocks
+
+// Before reading n bytes at off: if f is being read
+// sequentially, start reading the blocks the caller is about
+// to want, plus a window beyond them. The window doubles each
+// time it is refilled, up to MAXREADAHEAD, and is refilled
+// once the reader is halfway into it, so the disk sees
+// batches of adjacent blocks it can merge. A read from
+// anywhere else turns readahead off until reads are
+// sequential again. Caller holds f->ip->lock.
+static void
+readahead(struct file *f, uint off, uint n)
+{
+  uint first, end;
+
+  if(off != f->raoff){
+    f->rawin = 0;
+    f->rablock = 0;
+    return;
+  }
+  first = off / BSIZE;
+  end = (off + n + BSIZE - 1) / BSIZE;
+  if(end > first + MAXREADAHEAD)
+    end = first + MAXREADAHEAD;
+  if(f->rablock >= end + f->rawin / 2 && f->rawin > 0)
+    return;  // still well ahead
+  if(f->rawin == 0)
+    f->rawin = RAMIN;
+  else if(f->rawin < MAXREADAHEAD)
+    f->rawin = f->rawin * 2 < MAXREADAHEAD ? f->rawin * 2 : MAXREADAHEAD;
+  if(f->rablock < first)
+    f->rablock = first;
+  ireadahead(f->ip, f->rablock, end + f->rawin - f->rablock);
+  f->rablock = end + f->rawin;
+}
+
+static uint64
+iovlen(struct iovec *iov, int niov)
+{
+  uint64 n = 0;
+
+  for(int i = 0; i < niov; i++)
+    n += iov[i].iov_len;
+  return n;
+}
+
+// Read inode file f at *off into the user buffers iov[],
+// in turn, under one ilock(). Advances *off. Only reads at
+// f->off drive readahead; a pread() elsewhere leaves the
+// sequential reader's window alone.
+static int
+inoderead(struct file *f, struct iovec *iov, int niov, uint *off)
+{
+  int i, r, tot, seq;
+
+  tot = 0;
+  seq = off == &f->off;
+  ilock(f->ip);
+  if(seq)
+    readahead(f, *off, iovlen(iov, niov));
+  for(i = 0; i < niov; i++){
+    r = readi(f->ip, 1, (uint64)iov[i].iov_base, *off, iov[i].iov_len);
+    if(r < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    *off += r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  if(seq)
+    f->raoff = *off;
+  iunlock(f->ip);
+  return tot;
+}
+
+// Write the user buffers iov[], in turn, to inode file f at
+// *off. Advances *off. A call that fits in one log
+// transaction gets one, and one ilock().
+static int
+inodewrite(struct file *f, struct iovec *iov, int niov, uint *off)
+{
+  uint64 total, done;
+  int i, r, m, n1, left, tot;
+
+  // write in chunks that fit in one log transaction,
+  // reserving log space for each chunk's data blocks
+  // plus WRITESLOP blocks for the i-node, block map,
+  // allocation bitmap blocks, and an extra data block
+  // for non-aligned writes. a chunk touches no more
+  // blocks than writei() can hold back from allocation
+  // (NDELAY, less one for a non-aligned start): the blocks
+  // past that would get disk blocks in place, ahead of the
+  // held-back ones, and split the file's run in two.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = (log_opmax() - WRITESLOP) * BSIZE;
+  if(max > (NDELAY - 1) * BSIZE)
+    max = (NDELAY - 1) * BSIZE;
+
+  total = iovlen(iov, niov);
+  tot = 0;
+  i = 0;
+  done = 0;  // bytes of iov[i] written
+  while(tot < total){
+    n1 = total - tot;
+    if(n1 > max)
+      n1 = max;
+    int nb = (n1 + BSIZE - 1) / BSIZE + WRITESLOP;
+
+    // if the blocks already held back leave no room for
+    // this chunk's, allocate them first. ndelay is only
+    // a hint here; writei() allocates in place if the
+    // room has gone.
+    int touched = (*off % BSIZE + n1 + BSIZE - 1) / BSIZE;
+    if(f->ip->ndelay > 0 && f->ip->ndelay + touched > NDELAY)
+      flushdelay(f->ip);
+
+    begin_opn(f->ip->dev, nb);
+    ilock(f->ip);
+    for(left = n1; left > 0; left -= r, done += r, tot += r){
+      while(done == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
+      m = left < iov[i].iov_len - done ? left : iov[i].iov_len - done;
+      if((r = writei(f->ip, 1, (uint64)iov[i].iov_base + done, *off, m)) > 0)
+        *off += r;
+      if(r != m)
+        break;  // error from writei
+    }
+    iunlock(f->ip);
+    end_opn(f->ip->dev, nb);
+
+    if(left > 0)
+      break;
+  }
+  return tot == total ? tot : -1;
+}
+
+// Read from file f into the user buffers iov[] (a kernel
+// copy of the array), at off, or at f->off if off is -1.
+// A pipe or device fills only the first non-empty buffer,
+// as one read would.
 int
-fileread(struct file *f, uint64 addr, int n)
+filereadv(struct file *f, struct iovec *iov, int niov, int off)
 {
+  uint o;
   int r = 0;
 
   if(f->readable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
 
+  if(f->type == FD_INODE){
+    if(off < 0)
+      return inoderead(f, iov, niov, &f->off);
+    o = off;
+    return inoderead(f, iov, niov, &o);
+  }
+
+  while(niov > 0 && iov->iov_len == 0){
+    iov++;
+    niov--;
+  }
+  if(niov == 0)
+    return 0;
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, (uint64)iov->iov_base, iov->iov_len);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
-  } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    r = devsw[f->major].read(1, (uint64)iov->iov_base, iov->iov_len);
+  } else if(f->type == FD_EPOLL){
+    return -1;
   } else {
     panic("fileread");
   }
@@ -129,54 +316,187 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Write the user buffers iov[] (a kernel copy of the array)
+// to file f, at off, or at f->off if off is -1.
+int
+filewritev(struct file *f, struct iovec *iov, int niov, int off)
+{
+  uint o;
+  int i, r, ret = 0;
+
+  if(f->writable == 0)
+    return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;
+
+  if(f->type == FD_INODE){
+    if(off < 0)
+      return inodewrite(f, iov, niov, &f->off);
+    o = off;
+    return inodewrite(f, iov, niov, &o);
+  }
+
+  for(i = 0; i < niov; i++){
+    if(f->type == FD_PIPE){
+      r = pipewrite(f->pipe, (uint64)iov[i].iov_base, iov[i].iov_len);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+        return -1;
+      r = devsw[f->major].write(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+    } else {
+      panic("filewrite");
+    }
+    if(r < 0)
+      return ret > 0 ? ret : -1;
+    ret += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+
+  return ret;
+}
+
+// Read from file f.
+// addr is a user virtual address.
+int
+fileread(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  if(n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
 
-  if(f->writable == 0)
+  if(n < 0)
     return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, -1);
+}
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
-      return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+// Move inode file f's offset to off from the start, the
+// current offset, or the end, as whence says. Returns the
+// new offset, which may be past the end: a write there
+// leaves a hole that reads as zeros.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  if(whence == SEEK_SET){
+    base = 0;
+  } else if(whence == SEEK_CUR){
+    base = f->off;
+  } else if(whence == SEEK_END){
+    ilock(f->ip);
+    base = f->ip->size;
+    iunlock(f->ip);
   } else {
-    panic("filewrite");
+    return -1;
   }
+  if(off > 0 ? base > 0x7fffffff - off : base + off < 0)
+    return -1;
+  f->off = base + off;
+  return f->off;
+}
 
-  return ret;
+// Make inode file f's data and i-node durable: give its
+// delayed blocks disk blocks, then wait for the last log
+// transaction that changed it to commit.
+int
+filesync(struct file *f)
+{
+  int t;
+
+  if(f->type != FD_INODE)
+    return -1;
+  if(f->ip->dev == TMPDEV)
+    return 0;  // nothing to make durable
+  if(f->ip->ndelay > 0)
+    flushdelay(f->ip);
+  ilock(f->ip);
+  t = f->ip->tseq;
+  iunlock(f->ip);
+  log_force(f->ip->dev, t);
+  return 0;
 }
 
+// Set the size of inode file f to len.
+int
+filetruncate(struct file *f, uint len)
+{
+  int r;
+
+  if(f->type != FD_INODE || f->writable == 0 || f->ip->type != T_FILE)
+    return -1;
+  begin_opn(f->ip->dev, MAXOPBLOCKS);
+  ilock(f->ip);
+  r = itruncate(f->ip, len);
+  iunlock(f->ip);
+  end_opn(f->ip->dev, MAXOPBLOCKS);
+  return r;
+}
+
+// Give inode file f disk blocks for bytes off..off+len-1,
+// so that writing there later can't run out of space, and
+// unless mode has FALLOC_FL_KEEP_SIZE, make the file at
+// least off+len bytes long. The blocks come from the
+// file's preallocation windows, so a range allocated in
+// one go is laid out as contiguously as free space allows.
+int
+filefallocate(struct file *f, int mode, uint off, uint len)
+{
+  struct inode *ip = f->ip;
+  uint bn, end, n, max;
+  int r;
+
+  if(f->type != FD_INODE || f->writable == 0 || ip->type != T_FILE)
+    return -1;
+  if((mode & ~FALLOC_FL_KEEP_SIZE) || len == 0 || off + len < off)
+    return -1;
+
+  // blocks held back from allocation would be
+  // allocated again when they are flushed.
+  if(ip->ndelay > 0)
+    flushdelay(ip);
+
+  // as many blocks per transaction as filewrite() writes.
+  max = log_opmax() - WRITESLOP;
+  bn = off / BSIZE;
+  end = (off + len - 1) / BSIZE + 1;
+  r = 0;
+  while(r == 0 && bn < end){
+    n = end - bn < max ? end - bn : max;
+    begin_opn(ip->dev, n + WRITESLOP);
+    ilock(ip);
+    if(!(ip->flags & I_EXTENT) && end > MAXFILE)
+      r = -1;
+    else
+      r = iprealloc(ip, bn, n);
+    iunlock(ip);
+    end_opn(ip->dev, n + WRITESLOP);
+    bn += n;
+  }
+  if(r < 0 || (mode & FALLOC_FL_KEEP_SIZE))
+    return r;
+
+  begin_opn(ip->dev, MAXOPBLOCKS);
+  ilock(ip);
+  if(off + len > ip->size)
+    r = itruncate(ip, off + len);
+  iunlock(ip);
+  end_opn(ip->dev, MAXOPBLOCKS);
+  return r;
+}
@@ -1,11 +1,16 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_EPOLL } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe; // FD_PIPE
+  struct epoll *ep;  // FD_EPOLL
+  struct epitem *epitems;  // FD_PIPE and FD_DEVICE: epoll items watching f
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint raoff;        // FD_INODE: where a sequential read would start
+  uint rablock;      // FD_INODE: blocks before this were read ahead
+  int rawin;         // FD_INODE: readahead window, in blocks
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +23,11 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // inode table hash chain
+  struct inode *lprev;  // inode table LRU list, if onlru
+  struct inode *lnext;  // ... or unused list
+  int onlru;
+  int claimed;        // being recycled by inew()
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,13 +36,34 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  ushort flags;
+  uint addrs[NADDRS];
+
+  // the last mapping bmap() looked up; see fs.c.
+  uint mapbn;
+  uint mapaddr;
+  uint maplen;        // 0 if none
+
+  // blocks reserved for ip's next allocations; see fs.c.
+  uint pastart;
+  uint palen;
+
+  int tseq;           // last log transaction to change ip
+
+  // written blocks dstart..dstart+ndelay-1, not yet given
+  // disk blocks; see idelay() in fs.c.
+  struct buf *delay[NDELAY];
+  uint dstart;
+  uint ndelay;
+  uint npromise;      // free blocks promised to them
 };
 
 // map major device number to device functions.
+struct epitem;
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*watch)(struct epitem*, int);  // epoll; may be 0
 };
 
 extern struct devsw devsw[];
@@ -22,9 +22,6 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
 
 // Read the super block.
 static void
@@ -37,13 +34,85 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
-// Init fs
-void
+// Blocks.
+//
+// The disk is divided into allocation groups of AGSIZE
+// blocks. Each group keeps an in-memory copy of its part of
+// the free bitmap, built at boot, with a summary of it: how
+// many blocks are free and the longest free run. Allocation
+// searches these under the group's own lock, so it reads no
+// bitmap blocks to find space, skips groups that can't help,
+// and allocations in different groups don't contend. The
+// on-disk bitmap is still updated, through the log, for each
+// block that is actually allocated or freed.
+//
+// A bit that is set in memory but not on disk is reserved:
+// not in use, but not to be handed out either. Files being
+// appended to reserve a window of PREALLOC blocks ahead
+// (see iballoc()), so that files growing side by side still
+// get contiguous runs. Reservations are in memory only, and
+// so vanish in a crash.
+
+#define AGSIZE    256  // blocks per allocation group
+#define NAG       ((FSSIZE + AGSIZE - 1) / AGSIZE)
+#define PREALLOC  8    // blocks reserved ahead for an appending file
+#define LOWFREE   64   // free blocks, beyond those in windows, below
+                       // which windows are given back
+
+struct agroup {
+  struct spinlock lock;
+  uint nfree;              // free blocks
+  uint maxrun;             // longest run of free blocks
+  uchar map[AGSIZE/8];     // 1 = in use or reserved
+};
+
+// A disk file system in use: its superblock and
+// allocation groups.
+struct fsdev {
+  uint dev;                // 0 if the slot is free
+  struct superblock sb;
+  uint nwindow;            // blocks reserved in inodes' windows
+  struct spinlock lock;    // protects avail
+  uint avail;              // free blocks not promised to delayed
+                           // writes; see idelay()
+  int nag;
+  struct agroup ag[NAG];
+} fsdevs[NDISK];
+
+static void aginit(struct fsdev*);
+
+// The file system on disk dev.
+static struct fsdev*
+fsdev(uint dev)
+{
+  struct fsdev *fs;
+
+  for(fs = fsdevs; fs < fsdevs + NDISK; fs++)
+    if(fs->dev == dev)
+      return fs;
+  panic("fsdev");
+}
+
+// Start using the file system on disk dev. Returns -1 if dev
+// doesn't hold one, or its log can't be used. Mounts are
+// serialized by mount().
+int
 fsinit(int dev) {
-  readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
-    panic("invalid file system");
-  initlog(dev, &sb);
+  struct fsdev *fs;
+
+  for(fs = fsdevs; fs < fsdevs + NDISK && fs->dev; fs++)
+    ;
+  if(fs == fsdevs + NDISK)
+    return -1;
+  readsb(dev, &fs->sb);
+  if(fs->sb.magic != FSMAGIC || fs->sb.size > NAG * AGSIZE)
+    return -1;
+  if(initlog(dev, &fs->sb) < 0)
+    return -1;
+  fs->dev = dev;
+  initlock(&fs->lock, "fsdev");
+  aginit(fs);
+  return 0;
 }
 
 // Zero a block.
@@ -52,41 +121,249 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bgetnew(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
 }
 
-// Blocks.
+static int
+agisset(struct agroup *ag, uint bi)
+{
+  return ag->map[bi/8] & (1 << (bi % 8));
+}
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint
-balloc(uint dev)
+// Recompute ag's longest free run. Caller holds its lock.
+static void
+agsummary(struct agroup *ag)
+{
+  uint bi, run;
+
+  ag->maxrun = 0;
+  for(bi = run = 0; bi < AGSIZE; bi++){
+    run = agisset(ag, bi) ? 0 : run + 1;
+    if(run > ag->maxrun)
+      ag->maxrun = run;
+  }
+}
+
+// Load the free bitmap into the allocation groups.
+static void
+aginit(struct fsdev *fs)
 {
-  int b, bi, m;
+  struct agroup *ag;
   struct buf *bp;
+  uint b;
 
+  fs->nag = (fs->sb.size + AGSIZE - 1) / AGSIZE;
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  for(b = 0; b < fs->nag * AGSIZE; b++){
+    ag = &fs->ag[b / AGSIZE];
+    if(b % AGSIZE == 0){
+      initlock(&ag->lock, "agroup");
+      memset(ag->map, 0, sizeof(ag->map));
+      ag->nfree = 0;
+    }
+    if(b % BPB == 0 && b < fs->sb.size){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      bp = bread(fs->dev, BBLOCK(b, fs->sb));
     }
+    // blocks past the end are never free.
+    if(b >= fs->sb.size || (bp->data[(b % BPB)/8] & (1 << (b % 8))))
+      ag->map[(b % AGSIZE)/8] |= 1 << (b % 8);
+    else
+      ag->nfree++;
+    if(b % AGSIZE == AGSIZE - 1){
+      agsummary(ag);
+      fs->avail += ag->nfree;
+    }
+  }
+  if(bp)
     brelse(bp);
+}
+
+// Reserve a run of up to want free blocks, of at least
+// need, in group g, starting at one of the scan offsets from
+// offset from onwards (wrapping around).
+// Returns the first block and sets *got, or returns 0.
+static uint
+agtake(struct fsdev *fs, int g, uint from, uint scan, uint need, uint want, uint *got)
+{
+  struct agroup *ag = &fs->ag[g];
+  uint i, bi, n;
+
+  acquire(&ag->lock);
+  if(ag->maxrun < need){
+    release(&ag->lock);
+    return 0;
+  }
+  for(i = 0; i < scan; i++){
+    bi = (from + i) % AGSIZE;
+    if(agisset(ag, bi))
+      continue;
+    for(n = 0; n < want && bi + n < AGSIZE && !agisset(ag, bi + n); n++)
+      ;
+    if(n < need)
+      continue;
+    *got = n;
+    ag->nfree -= n;
+    for(; n > 0; n--, bi++)
+      ag->map[bi/8] |= 1 << (bi % 8);
+    agsummary(ag);
+    release(&ag->lock);
+    return g * AGSIZE + bi - *got;
   }
-  printf("balloc: out of blocks\n");
+  release(&ag->lock);
   return 0;
 }
 
+// Blocks promised to an inode's delayed writes (see idelay())
+// are counted in its npromise rather than in fs->avail; only
+// the inode's own allocations may use them. Each allocation
+// draws its blocks from a pool: *pool for an inode's promise,
+// fs->avail if pool is 0.
+
+// Take up to want blocks from a pool. Returns how many.
+static uint
+bquota(struct fsdev *fs, uint *pool, uint want)
+{
+  uint q;
+
+  if(pool){
+    q = min(want, *pool);
+    *pool -= q;
+    return q;
+  }
+  acquire(&fs->lock);
+  q = min(want, fs->avail);
+  fs->avail -= q;
+  release(&fs->lock);
+  return q;
+}
+
+// Return n blocks to a pool.
+static void
+bunquota(struct fsdev *fs, uint *pool, uint n)
+{
+  if(pool){
+    *pool += n;
+    return;
+  }
+  acquire(&fs->lock);
+  fs->avail += n;
+  release(&fs->lock);
+}
+
+// Reserve a run of up to want free blocks on dev, from pool,
+// as near as possible to block goal: at goal itself if it is
+// free, else preferring a full run, in goal's group or the
+// ones after it. Returns the first block and sets *got, or
+// returns 0 if the disk or the pool is exhausted.
+static uint
+breserve(uint dev, uint goal, uint want, uint *got, uint *pool)
+{
+  struct fsdev *fs = fsdev(dev);
+  uint b, need;
+  int i, g, g0;
+
+  if((want = bquota(fs, pool, want)) == 0)
+    return 0;
+  if(goal >= fs->sb.size)
+    goal = 0;
+  g0 = goal / AGSIZE;
+  if((b = agtake(fs, g0, goal % AGSIZE, 1, 1, want, got)) != 0)
+    goto out;
+  for(need = want; ; need = 1){
+    for(i = 0; i < fs->nag; i++){
+      g = (g0 + i) % fs->nag;
+      b = agtake(fs, g, i == 0 ? goal % AGSIZE : 0, AGSIZE, need, want, got);
+      if(b != 0)
+        goto out;
+    }
+    if(need == 1)
+      break;
+  }
+  *got = 0;
+
+ out:
+  bunquota(fs, pool, want - *got);
+  return b;
+}
+
+// Give back reserved blocks b..b+n-1 of dev without using
+// them, to pool.
+static void
+bunreserve(uint dev, uint b, uint n, uint *pool)
+{
+  struct fsdev *fs = fsdev(dev);
+  struct agroup *ag;
+
+  bunquota(fs, pool, n);
+  for(; n > 0; n--, b++){
+    ag = &fs->ag[b / AGSIZE];
+    acquire(&ag->lock);
+    ag->map[(b % AGSIZE)/8] &= ~(1 << (b % 8));
+    ag->nfree++;
+    agsummary(ag);
+    release(&ag->lock);
+  }
+}
+
+// Mark reserved block b in use on disk.
+static void
+bmark(uint dev, uint b)
+{
+  struct buf *bp;
+  int bi, m;
+
+  bp = bread(dev, BBLOCK(b, fsdev(dev)->sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m)
+    panic("bmark: block in use");
+  bp->data[bi/8] |= m;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Mark reserved block b in use on disk, and zero it.
+static void
+buse(uint dev, uint b)
+{
+  bmark(dev, b);
+  bzero(dev, b);
+}
+
+// How many blocks of dev are neither in use nor reserved.
+static uint
+bnfree(uint dev)
+{
+  struct fsdev *fs = fsdev(dev);
+  uint n;
+  int g;
+
+  n = 0;
+  for(g = 0; g < fs->nag; g++)
+    n += fs->ag[g].nfree;  // a hint; no lock
+  return n;
+}
+
+// Allocate a zeroed disk block, near goal if possible.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b, got;
+
+  if((b = breserve(dev, goal, 1, &got, 0)) == 0){
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  buse(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -94,7 +371,7 @@ bfree(int dev, uint b)
   struct buf *bp;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
+  bp = bread(dev, BBLOCK(b, fsdev(dev)->sb));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
@@ -102,6 +379,82 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  bunreserve(dev, b, 1, 0);
+}
+
+// Is dev so short of space that the blocks reserved in
+// windows should go back?
+static int
+bpressure(uint dev)
+{
+  return bnfree(dev) < fsdev(dev)->nwindow + LOWFREE;
+}
+
+// Drop ip's window of reserved blocks.
+static void
+idropwindow(struct inode *ip)
+{
+  if(ip->palen){
+    bunreserve(ip->dev, ip->pastart, ip->palen, 0);
+    __sync_fetch_and_sub(&fsdev(ip->dev)->nwindow, ip->palen);
+    ip->palen = 0;
+  }
+}
+
+// Allocate a block for ip, near goal. When ip has no
+// blocks reserved at goal, reserve a window of PREALLOC
+// there (dropping any old one), or of just the one block if
+// the disk is nearly full; blocks after the first stay ip's
+// for its next allocations, as long as they continue the
+// same run. Caller holds ip->lock.
+static uint
+iballoc(struct inode *ip, uint goal)
+{
+  uint b;
+
+  if(ip->palen && ip->pastart != goal)
+    idropwindow(ip);
+  if(ip->palen == 0){
+    b = breserve(ip->dev, goal, bpressure(ip->dev) ? 1 : PREALLOC, &ip->palen, 0);
+    if(b == 0){
+      printf("balloc: out of blocks\n");
+      return 0;
+    }
+    ip->pastart = b;
+    __sync_fetch_and_add(&fsdev(ip->dev)->nwindow, ip->palen);
+  }
+  b = ip->pastart++;
+  ip->palen--;
+  __sync_fetch_and_sub(&fsdev(ip->dev)->nwindow, 1);
+  buse(ip->dev, b);
+  return b;
+}
+
+// A file open for writing is being closed. If ip's disk is
+// nearly full, give back ip's window now rather than when ip
+// leaves the inode table. Caller holds no inode locks.
+void
+itrimwindow(struct inode *ip)
+{
+  // palen is only a hint without the lock.
+  if(ip->dev == TMPDEV || ip->palen == 0 || !bpressure(ip->dev))
+    return;
+  ilock(ip);
+  idropwindow(ip);
+  iunlock(ip);
+}
+
+// Where to look for ip's first block: spread files over
+// the data groups by inode number.
+static uint
+igoal(struct inode *ip)
+{
+  struct superblock *sb = &fsdev(ip->dev)->sb;
+  uint data = sb->bmapstart + sb->size / BPB + 1;
+
+  if(data >= sb->size)
+    return 0;
+  return data + (ip->inum * AGSIZE) % (sb->size - data);
 }
 
 // Inodes.
@@ -119,7 +472,9 @@ bfree(int dev, uint b)
 // to provide a place for synchronizing access
 // to inodes used by multiple processes. The in-memory
 // inodes include book-keeping information that is
-// not stored on disk: ip->ref and ip->valid.
+// not stored on disk: ip->ref and ip->valid. Entries that
+// are no longer in use stay in the table, still valid, in
+// case the inode is wanted again, until iget() needs room.
 //
 // An inode and its in-memory representation go through a
 // sequence of states before they can be used by the
@@ -130,9 +485,9 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
+//   can be recycled if ip->ref is zero. Otherwise ip->ref
+//   tracks the number of in-memory pointers to the entry
+//   (open files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
 //   decrements ref.
 //
@@ -140,7 +495,8 @@ bfree(int dev, uint b)
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if it frees the inode, and iget() when it
+//   recycles the entry for another inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,32 +520,191 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is a hash table keyed by dev and inum, whose
+// entries are allocated a page at a time, up to NINODE.
+// Each hash bucket has a spin-lock that protects its chain
+// and the ref of the inodes on it; one must hold it while
+// using ip->ref. Unreferenced entries stay on their chains,
+// and also on an LRU list, from which iget() recycles the
+// oldest once the table can't grow. ip->dev and ip->inum
+// only change while an entry is on no chain.
+//
+// itable.lock protects the LRU list, the list of unused
+// entries, ip->claimed, and the table size. It is taken inside a bucket
+// lock, never the other way round.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 64
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *lru;      // unreferenced entries, oldest first
+  struct inode *lrutail;
+  struct inode *free;     // entries holding no inode
+  int n;                  // entries allocated
 } itable;
 
+struct {
+  struct spinlock lock;
+  struct inode *head;     // chain through hnext
+} ihash[NIHASH];
+
+// Mount table: the root of each mounted file system, and
+// the directory it covers. Entries are added, never removed,
+// so lookups can read them without the lock once they see
+// a slot filled.
+struct {
+  struct spinlock lock;
+  struct mount {
+    struct inode *on;    // 0 if the slot is free
+    struct inode *root;
+  } m[NMOUNT];
+  struct sleeplock mounting;  // held by mount()
+} mtable;
+
 void
 iinit()
 {
-  int i = 0;
-  
+  int i;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  for(i = 0; i < NIHASH; i++)
+    initlock(&ihash[i].lock, "ihash");
+  initlock(&mtable.lock, "mtable");
+  initsleeplock(&mtable.mounting, "mounting");
+}
+
+static struct spinlock*
+ilocktab(struct inode *ip)
+{
+  return &ihash[IHASH(ip->dev, ip->inum)].lock;
+}
+
+// Put unreferenced ip on the LRU list: at the old end if it
+// holds nothing worth keeping. Caller holds ip's bucket lock.
+static void
+lru_add(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->onlru = 1;
+  if(!ip->valid){
+    ip->lprev = 0;
+    ip->lnext = itable.lru;
+    if(itable.lru)
+      itable.lru->lprev = ip;
+    else
+      itable.lrutail = ip;
+    itable.lru = ip;
+  } else {
+    ip->lnext = 0;
+    ip->lprev = itable.lrutail;
+    if(itable.lrutail)
+      itable.lrutail->lnext = ip;
+    else
+      itable.lru = ip;
+    itable.lrutail = ip;
+  }
+  release(&itable.lock);
+}
+
+// Take ip off the LRU list, if it is there.
+// Caller holds itable.lock.
+static void
+lru_del(struct inode *ip)
+{
+  if(!ip->onlru)
+    return;
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    itable.lru = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    itable.lrutail = ip->lprev;
+  ip->onlru = 0;
+}
+
+// Add a page of entries to the unused list.
+// Caller holds itable.lock.
+static void
+igrow(void)
+{
+  struct inode *ip;
+  char *page;
+  int i;
+
+  if((page = kalloc()) == 0)
+    return;
+  memset(page, 0, PGSIZE);
+  for(i = 0; i < PGSIZE / sizeof(struct inode) && itable.n < NINODE; i++){
+    ip = (struct inode*)page + i;
+    initsleeplock(&ip->lock, "inode");
+    ip->lnext = itable.free;
+    itable.free = ip;
+    itable.n++;
+  }
+}
+
+// Return a table entry that is on no chain: an unused one,
+// a new one, or the least recently used unreferenced one.
+static struct inode*
+inew(void)
+{
+  struct inode *ip;
+  struct spinlock *lk;
+
+  for(;;){
+    acquire(&itable.lock);
+    if(itable.free == 0 && itable.n < NINODE)
+      igrow();
+    if((ip = itable.free) != 0){
+      itable.free = ip->lnext;
+      release(&itable.lock);
+      return ip;
+    }
+    if((ip = itable.lru) == 0)
+      panic("iget: no inodes");
+    lru_del(ip);
+    if(ip->claimed){
+      // used and put back while another inew() was
+      // between the locks; that one decides its fate.
+      release(&itable.lock);
+      continue;
+    }
+    ip->claimed = 1;
+    release(&itable.lock);
+
+    // between the locks someone may have taken ip up again.
+    // claimed keeps ip on its chain, with its dev and inum,
+    // until we let go of it.
+    lk = ilocktab(ip);
+    acquire(lk);
+    if(ip->ref == 0){
+      struct inode **pp = &ihash[IHASH(ip->dev, ip->inum)].head;
+      while(*pp != ip)
+        pp = &(*pp)->hnext;
+      *pp = ip->hnext;
+      acquire(&itable.lock);
+      lru_del(ip);  // in case it was used and put back
+      ip->claimed = 0;
+      release(&itable.lock);
+      release(lk);
+      ip->valid = 0;
+      return ip;
+    }
+    acquire(&itable.lock);
+    ip->claimed = 0;
+    release(&itable.lock);
+    release(lk);
   }
 }
 
-static struct inode* iget(uint dev, uint inum);
+static void idropdelay(struct inode*);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -201,13 +716,21 @@ ialloc(uint dev, short type)
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct fsdev *fs;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
+  if(dev == TMPDEV)
+    return tmp_ialloc(type);
+  fs = fsdev(dev);
+  for(inum = 1; inum < fs->sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, fs->sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      if(type == T_FILE && (fs->sb.flags & FS_INLINE))
+        dip->flags = I_INLINE;
+      else if(fs->sb.flags & FS_EXTENT)
+        dip->flags = I_EXTENT;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
@@ -218,6 +741,16 @@ ialloc(uint dev, short type)
   return 0;
 }
 
+// The size to record on disk: blocks awaiting allocation
+// aren't there yet.
+static uint
+idisksize(struct inode *ip)
+{
+  if(ip->ndelay > 0)
+    return min(ip->size, ip->dstart * BSIZE);
+  return ip->size;
+}
+
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
 // that lives on disk.
@@ -228,52 +761,74 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  if(ip->dev == TMPDEV){
+    tmp_iupdate(ip);
+    return;
+  }
+  bp = bread(ip->dev, IBLOCK(ip->inum, fsdev(ip->dev)->sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
+  dip->size = idisksize(ip);
+  dip->flags = ip->flags;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
+  ip->tseq = log_seq(ip->dev);
 }
 
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
-static struct inode*
+struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
-
-  acquire(&itable.lock);
+  struct inode *ip, *fresh;
+  int h = IHASH(dev, inum);
+
+  fresh = 0;
+  for(;;){
+    acquire(&ihash[h].lock);
+
+    // Is the inode already in the table?
+    for(ip = ihash[h].head; ip; ip = ip->hnext){
+      if(ip->dev == dev && ip->inum == inum){
+        if(ip->ref++ == 0){
+          acquire(&itable.lock);
+          lru_del(ip);
+          release(&itable.lock);
+        }
+        release(&ihash[h].lock);
+        if(fresh){
+          // someone else added it meanwhile.
+          acquire(&itable.lock);
+          fresh->lnext = itable.free;
+          itable.free = fresh;
+          release(&itable.lock);
+        }
+        return ip;
+      }
+    }
 
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
+    if(fresh){
+      ip = fresh;
+      ip->dev = dev;
+      ip->inum = inum;
+      ip->ref = 1;
+      ip->valid = 0;
+      ip->hnext = ihash[h].head;
+      ihash[h].head = ip;
+      release(&ihash[h].lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
-
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
-  ip->ref = 1;
-  ip->valid = 0;
-  release(&itable.lock);
 
-  return ip;
+    // find an entry without holding the bucket lock,
+    // then look again.
+    release(&ihash[h].lock);
+    fresh = inew();
+  }
 }
 
 // Increment reference count for ip.
@@ -281,9 +836,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct spinlock *lk = ilocktab(ip);
+
+  acquire(lk);
   ip->ref++;
-  release(&itable.lock);
+  release(lk);
   return ip;
 }
 
@@ -300,16 +857,24 @@ ilock(struct inode *ip)
 
   acquiresleep(&ip->lock);
 
-  if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  if(ip->valid == 0 && ip->dev == TMPDEV){
+    tmp_iload(ip);
+    ip->valid = 1;
+  } else if(ip->valid == 0){
+    bp = bread(ip->dev, IBLOCK(ip->inum, fsdev(ip->dev)->sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->flags = dip->flags;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->maplen = 0;
+    // changes made before ip left the table may not
+    // have committed yet.
+    ip->tseq = log_seq(ip->dev);
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -331,12 +896,34 @@ iunlock(struct inode *ip)
 // be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
-// All calls to iput() must be inside a transaction in
-// case it has to free the inode.
+// Freeing needs a transaction on ip's device. If the caller
+// hasn't joined that one, iput() runs its own, once the
+// caller's FS call (if any) has ended; a caller outside any
+// transaction must then hold no inode or buffer locks.
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct spinlock *lk = ilocktab(ip);
+  struct proc *p;
+  uint dev;
+
+  acquire(lk);
+
+  if(ip->ref == 1 && ip->valid && ip->nlink == 0 && !log_joined(ip->dev)){
+    release(lk);
+    p = myproc();
+    if(log_inop()){
+      // keep the reference until end_op().
+      ip->lnext = p->iputq;
+      p->iputq = ip;
+    } else {
+      dev = ip->dev;
+      begin_op(dev);
+      iput(ip);
+      end_op(dev);
+    }
+    return;
+  }
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,20 +932,44 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(lk);
 
     itrunc(ip);
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(lk);
   }
 
   ip->ref--;
-  release(&itable.lock);
+  if(ip->ref == 0){
+    // no one else can see ip now.
+    idropwindow(ip);
+    idropdelay(ip);
+    lru_add(ip);
+  }
+  release(lk);
+}
+
+// Put the inodes iput() left to free after the FS call
+// that has just ended, each in a transaction of its own.
+void
+iputdeferred(void)
+{
+  struct proc *p = myproc();
+  struct inode *ip, *next;
+
+  ip = p->iputq;
+  p->iputq = 0;
+  for(; ip; ip = next){
+    next = ip->lnext;
+    iput(ip);
+  }
 }
 
 // Common idiom: unlock, then put.
@@ -372,86 +983,837 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
-
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
-// returns 0 if out of disk space.
+// in blocks on the disk, mapped in one of two ways.
+//
+// Block-mapped inodes list the first NDIRECT block numbers
+// in ip->addrs[]; the next NINDIRECT blocks are listed in
+// block ip->addrs[NDIRECT], the NDINDIRECT after that in the
+// indirect blocks listed in the double-indirect block
+// ip->addrs[NDIRECT+1], and the rest through the triple-
+// indirect block ip->addrs[NDIRECT+2].
+//
+// Extent-mapped inodes (I_EXTENT, which ialloc() sets when
+// the superblock has FS_EXTENT) keep the root of an extent
+// tree in ip->addrs[]; see fs.h. A file laid out in a few
+// contiguous runs needs only a few extents, the root holds
+// NEXTROOT of them, and beyond that the tree grows node
+// blocks below the root, so file size isn't limited by the map.
+//
+// So that sequential access doesn't walk the map from the
+// top for every block, ip->mapbn, mapaddr and maplen
+// remember the last lookup: for an extent inode, the extent
+// found (file blocks mapbn..mapbn+maplen-1 are at mapaddr
+// onwards); for a block-mapped one, the last indirect block
+// used (it lists file blocks mapbn..mapbn+maplen-1, and is
+// at disk block mapaddr). Blocks stay where they are once
+// mapped, so only itrunc() has to forget it.
+
+#define EXTENTS(h) ((struct extent*)((h) + 1))
+
+// Return the disk address of file block bn of extent-mapped
+// ip and set *n to the number of blocks from bn to the end of
+// its extent, or return 0 if bn isn't mapped.
 static uint
-bmap(struct inode *ip, uint bn)
+ext_lookup(struct inode *ip, uint bn, uint *n)
 {
-  uint addr, *a;
+  struct extenthdr *h;
+  struct extent *e;
   struct buf *bp;
+  uint addr;
+  int i;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
-    }
-    return addr;
+  if(ip->maplen && bn >= ip->mapbn && bn - ip->mapbn < ip->maplen){
+    *n = ip->maplen - (bn - ip->mapbn);
+    return ip->mapaddr + (bn - ip->mapbn);
   }
-  bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
+  h = (struct extenthdr*)ip->addrs;
+  bp = 0;
+  addr = 0;
+  *n = 0;
+  for(;;){
+    // the last entry starting at or before bn.
+    e = EXTENTS(h);
+    for(i = h->n - 1; i >= 0 && e[i].lblk > bn; i--)
+      ;
+    if(i < 0)
+      break;
+    if(h->depth == 0){
+      if(bn < e[i].lblk + e[i].len){
+        addr = e[i].start + (bn - e[i].lblk);
+        *n = e[i].lblk + e[i].len - bn;
+        ip->mapbn = e[i].lblk;
+        ip->mapaddr = e[i].start;
+        ip->maplen = e[i].len;
       }
+      break;
     }
-    brelse(bp);
-    return addr;
+    addr = e[i].start;
+    if(bp)
+      brelse(bp);
+    bp = bread(ip->dev, addr);
+    h = (struct extenthdr*)bp->data;
+    addr = 0;
   }
+  if(bp)
+    brelse(bp);
+  return addr;
+}
+
+// Insert x at position i of node h, which has room.
+static void
+ext_put(struct extenthdr *h, int i, struct extent *x)
+{
+  struct extent *e = EXTENTS(h);
 
-  panic("bmap: out of range");
+  memmove(&e[i+1], &e[i], (h->n - i) * sizeof(*e));
+  e[i] = *x;
+  h->n++;
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Node blocks for one insertion, reserved before any node is
+// changed: one per level that might split, and one for the
+// root to move down into.
+#define EXTSPARE 6
+
+struct extspare {
+  int n;
+  uint b[EXTSPARE];
+};
+
+// Mark a reserved spare block in use, and return it.
+static uint
+ext_take(struct inode *ip, struct extspare *sp)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  uint b;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
+  if(sp->n == 0)
+    panic("ext_take");
+  b = sp->b[--sp->n];
+  buse(ip->dev, b);
+  return b;
+}
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+// Add extent x to the subtree under node h, which lives in
+// bp, or in the inode if bp is 0, taking new node blocks from
+// sp. Returns 0 if done, or 1 if h had to be split: *up is
+// then the index entry for the new right half, for the caller
+// to add to h's parent. The root is never split; it moves its
+// entries down into a new node instead.
+static int
+ext_insert(struct inode *ip, struct extenthdr *h, struct buf *bp,
+           struct extent *x, struct extent *up, struct extspare *sp)
+{
+  struct extent *e, sub;
+  struct extenthdr *nh;
+  struct buf *nbp;
+  int i, k, r, dirty;
+  uint nb;
+
+  e = EXTENTS(h);
+  dirty = 0;
+  for(i = h->n - 1; i >= 0 && e[i].lblk > x->lblk; i--)
+    ;
+  if(h->depth == 0){
+    // extend the extent before x if x continues it.
+    if(i >= 0 && e[i].lblk + e[i].len == x->lblk &&
+       e[i].start + e[i].len == x->start){
+      e[i].len += x->len;
+      dirty = 1;
+      r = 0;
+      goto out;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    sub = *x;
+  } else {
+    if(i < 0){
+      // x comes before everything; the first child takes it.
+      i = 0;
+      e[0].lblk = x->lblk;
+      dirty = 1;
+    }
+    nbp = bread(ip->dev, e[i].start);
+    r = ext_insert(ip, (struct extenthdr*)nbp->data, nbp, x, &sub, sp);
+    brelse(nbp);
+    if(r == 0)
+      goto out;
   }
 
+  // add sub after entry i.
+  i++;
+  if(h->n < (bp ? NEXTNODE : NEXTROOT)){
+    ext_put(h, i, &sub);
+    dirty = 1;
+    r = 0;
+    goto out;
+  }
+  nb = ext_take(ip, sp);
+  nbp = bread(ip->dev, nb);
+  nh = (struct extenthdr*)nbp->data;
+  if(bp == 0){
+    // full root: push it down a level.
+    memmove(nh, h, sizeof(*h) + h->n * sizeof(*e));
+    ext_put(nh, i, &sub);
+    h->n = 1;
+    h->depth++;
+    e[0].lblk = EXTENTS(nh)[0].lblk;
+    e[0].start = nb;
+    e[0].len = 0;
+    r = 0;
+  } else {
+    // split. when appending, leave this node full and start
+    // the next one, so sequential files pack their nodes.
+    k = i == h->n ? h->n : h->n / 2;
+    nh->depth = h->depth;
+    nh->n = h->n - k;
+    memmove(EXTENTS(nh), &e[k], nh->n * sizeof(*e));
+    h->n = k;
+    if(i >= k)
+      ext_put(nh, i - k, &sub);
+    else
+      ext_put(h, i, &sub);
+    up->lblk = EXTENTS(nh)[0].lblk;
+    up->start = nb;
+    up->len = 0;
+    r = 1;
+  }
+  log_write(nbp);
+  brelse(nbp);
+  dirty = 1;
+
+ out:
+  // changes to the root reach the disk with the inode.
+  if(bp && dirty)
+    log_write(bp);
+  return r;
+}
+
+// Add extent x to extent-mapped ip, taking any new node
+// blocks from pool. Returns 0, or -1 if out of disk space for
+// the tree's nodes, in which case nothing has changed.
+static int
+ext_add(struct inode *ip, struct extent *x, uint *pool)
+{
+  struct extenthdr *h = (struct extenthdr*)ip->addrs;
+  struct extspare sp;
+  struct extent up;
+  uint got;
+
+  if(h->depth + 1 > EXTSPARE)
+    panic("ext_add: tree too deep");
+  for(sp.n = 0; sp.n < h->depth + 1; sp.n++){
+    if((sp.b[sp.n] = breserve(ip->dev, x->start, 1, &got, pool)) == 0){
+      while(sp.n > 0)
+        bunreserve(ip->dev, sp.b[--sp.n], 1, pool);
+      return -1;
+    }
+  }
+  ext_insert(ip, h, 0, x, &up, &sp);
+  while(sp.n > 0)
+    bunreserve(ip->dev, sp.b[--sp.n], 1, pool);
+  return 0;
+}
+
+// Free the blocks under node h, and its node blocks.
+static void
+ext_free(struct inode *ip, struct extenthdr *h)
+{
+  struct extent *e = EXTENTS(h);
+  struct buf *bp;
+  uint b;
+  int i;
+
+  for(i = 0; i < h->n; i++){
+    if(h->depth == 0){
+      for(b = 0; b < e[i].len; b++)
+        bfree(ip->dev, e[i].start + b);
+    } else {
+      bp = bread(ip->dev, e[i].start);
+      ext_free(ip, (struct extenthdr*)bp->data);
+      brelse(bp);
+      bfree(ip->dev, e[i].start);
+    }
+  }
+}
+
+// Free the blocks under node h that hold file blocks bn and
+// up, and the node blocks left empty. Returns 1 if h changed.
+static int
+ext_trunc(struct inode *ip, struct extenthdr *h, uint bn)
+{
+  struct extent *x;
+  struct extenthdr *c;
+  struct buf *bp;
+  uint k;
+  int changed = 0;
+
+  while(h->n > 0){
+    x = &EXTENTS(h)[h->n - 1];
+    if(h->depth == 0){
+      if(x->lblk + x->len <= bn)
+        break;
+      k = x->lblk < bn ? bn - x->lblk : 0;
+      changed = 1;
+      while(x->len > k){
+        x->len--;
+        bfree(ip->dev, x->start + x->len);
+      }
+      if(x->len > 0)
+        break;
+    } else {
+      bp = bread(ip->dev, x->start);
+      c = (struct extenthdr*)bp->data;
+      if(x->lblk >= bn){
+        ext_free(ip, c);
+      } else {
+        if(ext_trunc(ip, c, bn))
+          log_write(bp);
+        if(c->n > 0){
+          brelse(bp);
+          break;
+        }
+      }
+      brelse(bp);
+      bfree(ip->dev, x->start);
+    }
+    h->n--;
+    changed = 1;
+  }
+  return changed;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block and alloc is set, bmap allocates
+// one; otherwise it returns 0.
+// returns 0 if out of disk space.
+static uint
+bmap(struct inode *ip, uint bn, int alloc)
+{
+  uint addr, *a, len, fbn, span;
+  struct buf *bp;
+  struct extent x;
+  int level, i;
+
+  if(ip->flags & I_INLINE)
+    panic("bmap: inline");
+
+  if(ip->flags & I_EXTENT){
+    if((addr = ext_lookup(ip, bn, &len)) != 0 || !alloc)
+      return addr;
+    // right after the block before, if there is one.
+    if(bn == 0 || (addr = ext_lookup(ip, bn - 1, &len)) == 0)
+      addr = igoal(ip) - 1;
+    if((addr = iballoc(ip, addr + 1)) == 0)
+      return 0;
+    x.lblk = bn;
+    x.start = addr;
+    x.len = 1;
+    if(ext_add(ip, &x, 0) < 0){
+      bfree(ip->dev, addr);
+      return 0;
+    }
+    return addr;
+  }
+
+  if(bn < NDIRECT){
+    if((addr = ip->addrs[bn]) == 0 && alloc){
+      if(bn > 0 && ip->addrs[bn-1])
+        addr = iballoc(ip, ip->addrs[bn-1] + 1);
+      else
+        addr = iballoc(ip, igoal(ip));
+      if(addr == 0)
+        return 0;
+      ip->addrs[bn] = addr;
+    }
+    return addr;
+  }
+  fbn = bn;
+  bn -= NDIRECT;
+
+  // how many levels of indirect blocks lead to bn?
+  for(level = 1, span = NINDIRECT; bn >= span; level++, span *= NINDIRECT){
+    if(level == 3){
+      if(!alloc)
+        return 0;
+      panic("bmap: out of range");
+    }
+    bn -= span;
+  }
+
+  if(ip->maplen && fbn >= ip->mapbn && fbn - ip->mapbn < ip->maplen){
+    // same last-level indirect block as last time.
+    addr = ip->mapaddr;
+    level = 1;
+    span = NINDIRECT;
+  } else {
+    // Load top indirect block, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT + level - 1]) == 0){
+      if(!alloc)
+        return 0;
+      addr = balloc(ip->dev, ip->addrs[NDIRECT-1] + 1);
+      if(addr == 0)
+        return 0;
+      ip->addrs[NDIRECT + level - 1] = addr;
+    }
+  }
+
+  // walk down, allocating missing indirect blocks and,
+  // at the bottom, the data block.
+  for(; level > 0; level--){
+    span /= NINDIRECT;
+    if(level == 1){
+      ip->mapbn = fbn - bn % NINDIRECT;
+      ip->mapaddr = addr;
+      ip->maplen = NINDIRECT;
+    }
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    i = (bn / span) % NINDIRECT;
+    if((addr = a[i]) == 0){
+      if(!alloc){
+        brelse(bp);
+        return 0;
+      }
+      // data blocks follow the one before; indirect
+      // blocks follow their parent.
+      if(level > 1)
+        addr = balloc(ip->dev, bp->blockno + 1);
+      else if(i > 0 && a[i-1])
+        addr = iballoc(ip, a[i-1] + 1);
+      else
+        addr = iballoc(ip, bp->blockno + 1);
+      if(addr == 0){
+        brelse(bp);
+        return 0;
+      }
+      a[i] = addr;
+      log_write(bp);
+    }
+    brelse(bp);
+  }
+  return addr;
+}
+
+// Map up to n of ip's blocks, starting at file block bn, to
+// a run of consecutive disk blocks. Returns the disk address
+// of block bn and sets *run to the length of the run, at
+// least 1; or returns 0 if block bn isn't mapped (and alloc
+// is 0) or the disk is full. With alloc set, missing blocks
+// in the range are allocated as they are reached.
+uint
+bmap_range(struct inode *ip, uint bn, uint n, uint *run, int alloc)
+{
+  uint addr, len, k;
+
+  *run = 0;
+  if(n == 0)
+    return 0;
+  if((ip->flags & I_EXTENT) && (addr = ext_lookup(ip, bn, &len)) != 0){
+    *run = min(n, len);
+    return addr;
+  }
+  if((addr = bmap(ip, bn, alloc)) == 0)
+    return 0;
+  for(k = 1; k < n; k++)
+    if(bmap(ip, bn + k, alloc) != addr + k)
+      break;
+  *run = k;
+  return addr;
+}
+
+// Start reading n of ip's blocks from block bn, stopping at
+// the end of the file, without waiting for them.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint bn, uint n)
+{
+  uint nb, addr, run, i;
+
+  if((ip->flags & I_INLINE) || ip->dev == TMPDEV)
+    return;
+  nb = (ip->size + BSIZE - 1) / BSIZE;
+  if(bn + n > nb)
+    n = bn < nb ? nb - bn : 0;
+  for(; n > 0; n -= run, bn += run){
+    if((addr = bmap_range(ip, bn, n, &run, 0)) == 0)
+      break;
+    for(i = 0; i < run; i++)
+      breadahead(ip->dev, addr + i);
+  }
+  bkick();
+}
+
+// Delayed allocation.
+//
+// Blocks written past the end of a regular extent-mapped
+// file don't get disk blocks straight away: writei() keeps
+// them in buffers from bdelay(), up to NDELAY of them, as
+// file blocks ip->dstart onwards. iflush() allocates them
+// later all together, as one run if it can, and writes them
+// through the log; until then the size on disk stops short
+// of them, and writes that touch only them log nothing.
+// filewrite() calls iflush() when a write needs more room
+// than is left, and fileclose() on the way out.
+//
+// Each held-back block is promised a disk block when it is
+// created, as is room for the extent tree to grow: the blocks
+// move from fs->avail to ip->npromise, where no other
+// allocation can take them. So if the disk is full the write
+// allocates in place and fails then, and iflush() cannot run
+// out of space after the write has succeeded.
+
+#define DELAYNODES (2*EXTSPARE)  // promised for extent tree nodes
+
+// Promise n of dev's free blocks to ip. Returns -1 if there
+// aren't that many.
+static int
+ipromise(struct inode *ip, uint n)
+{
+  struct fsdev *fs = fsdev(ip->dev);
+
+  acquire(&fs->lock);
+  if(fs->avail < n){
+    release(&fs->lock);
+    return -1;
+  }
+  fs->avail -= n;
+  release(&fs->lock);
+  ip->npromise += n;
+  return 0;
+}
+
+// Return the buffer for file block bn of ip if bn is awaiting
+// allocation. If create is set and bn is an unmapped block past
+// the end of the file (or the next after those awaiting
+// allocation), start holding it in a new buffer. Otherwise
+// return 0, and bn is written in place. Caller holds ip->lock.
+static struct buf*
+idelay(struct inode *ip, uint bn, int create)
+{
+  struct buf *b;
+
+  if(ip->ndelay > 0 && bn >= ip->dstart && bn - ip->dstart < ip->ndelay)
+    return ip->delay[bn - ip->dstart];
+  if(!create || ip->type != T_FILE || !(ip->flags & I_EXTENT))
+    return 0;
+  if(ip->ndelay > 0){
+    if(bn != ip->dstart + ip->ndelay || ip->ndelay == NDELAY)
+      return 0;
+  } else if(bn < (ip->size + BSIZE - 1) / BSIZE){
+    return 0;
+  }
+  if(bmap(ip, bn, 0) != 0)
+    return 0;  // fallocate()d
+  if((b = bdelay(NDELAYBUF)) == 0)
+    return 0;
+  if(ipromise(ip, ip->ndelay == 0 ? 1 + DELAYNODES : 1) < 0){
+    bundelay(b);
+    return 0;
+  }
+  if(ip->ndelay == 0)
+    ip->dstart = bn;
+  ip->delay[ip->ndelay++] = b;
+  return b;
+}
+
+// Forget ip's blocks awaiting allocation, and give back
+// what is left of the blocks promised to them.
+static void
+idropdelay(struct inode *ip)
+{
+  while(ip->ndelay > 0)
+    bundelay(ip->delay[--ip->ndelay]);
+  if(ip->npromise > 0){
+    bunquota(fsdev(ip->dev), 0, ip->npromise);
+    ip->npromise = 0;
+  }
+}
+
+// Give ip's blocks awaiting allocation their disk blocks, in
+// as few runs as possible after the file's last block, and
+// write them through the log. Caller holds ip->lock, inside a
+// transaction with room for NDELAY blocks plus the i-node,
+// bitmap and extent tree blocks that allocating them dirties.
+void
+iflush(struct inode *ip)
+{
+  struct extent x;
+  struct buf *bp;
+  uint goal, len, b, got, i, j;
+
+  if(ip->ndelay == 0)
+    return;
+  idropwindow(ip);
+  goal = ip->dstart > 0 ? ext_lookup(ip, ip->dstart - 1, &len) : 0;
+  goal = goal ? goal + 1 : igoal(ip);
+  for(i = 0; i < ip->ndelay; i += got){
+    // the blocks were promised, so these can't fail.
+    b = breserve(ip->dev, goal, ip->ndelay - i, &got, &ip->npromise);
+    if(b == 0)
+      panic("iflush: promised blocks");
+    x.lblk = ip->dstart + i;
+    x.start = b;
+    x.len = got;
+    if(ext_add(ip, &x, &ip->npromise) < 0)
+      panic("iflush: promised nodes");
+    for(j = 0; j < got; j++){
+      bmark(ip->dev, b + j);
+      bp = bgetnew(ip->dev, b + j);
+      memmove(bp->data, ip->delay[i + j]->data, BSIZE);
+      log_write(bp);
+      brelse(bp);
+    }
+    goal = b + got;
+  }
+  idropdelay(ip);
+  iupdate(ip);
+}
+
+// Free indirect block addr and the blocks it lists; level
+// is 1 for a single, 2 for a double, 3 for a triple indirect
+// block.
+static void
+indfree(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      indfree(dev, a[j], level - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
+// Free the blocks under indirect block addr, of the given
+// level, that hold file blocks bn and up; its first entry maps
+// file block base. Returns 1 if addr is left empty, for the
+// caller to free.
+static int
+indtrunc(uint dev, uint addr, int level, uint base, uint bn)
+{
+  struct buf *bp;
+  uint *a, span, first;
+  int j, changed, empty;
+
+  span = 1;
+  for(j = 1; j < level; j++)
+    span *= NINDIRECT;
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  changed = 0;
+  empty = 1;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    first = base + j * span;
+    if(first >= bn){
+      if(level > 1)
+        indfree(dev, a[j], level - 1);
+      else
+        bfree(dev, a[j]);
+      a[j] = 0;
+      changed = 1;
+    } else if(level > 1 && first + span > bn){
+      if(indtrunc(dev, a[j], level - 1, first, bn)){
+        bfree(dev, a[j]);
+        a[j] = 0;
+        changed = 1;
+      }
+    }
+    if(a[j])
+      empty = 0;
+  }
+  if(changed && !empty)
+    log_write(bp);
+  brelse(bp);
+  return empty;
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void
+itrunc(struct inode *ip)
+{
+  int i;
+
+  if(ip->dev == TMPDEV){
+    tmp_itruncate(ip, 0);
+    return;
+  }
+  ip->maplen = 0;
+  idropwindow(ip);
+  idropdelay(ip);
+  if(ip->flags & I_INLINE){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+  } else if(ip->flags & I_EXTENT){
+    ext_free(ip, (struct extenthdr*)ip->addrs);
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+  } else {
+    for(i = 0; i < NDIRECT; i++){
+      if(ip->addrs[i]){
+        bfree(ip->dev, ip->addrs[i]);
+        ip->addrs[i] = 0;
+      }
+    }
+
+    for(i = 0; i < 3; i++){
+      if(ip->addrs[NDIRECT + i]){
+        indfree(ip->dev, ip->addrs[NDIRECT + i], i + 1);
+        ip->addrs[NDIRECT + i] = 0;
+      }
+    }
+  }
+
+  // an empty file starts out inline again.
+  if(ip->type == T_FILE && (fsdev(ip->dev)->sb.flags & FS_INLINE))
+    ip->flags = I_INLINE;
   ip->size = 0;
   iupdate(ip);
 }
 
+static int iuninline(struct inode*);
+
+// Set ip's size, freeing the blocks wholly past a smaller
+// one and zeroing the rest of its last block; a larger one
+// leaves a hole. Caller holds ip->lock, in a transaction.
+int
+itruncate(struct inode *ip, uint size)
+{
+  struct buf *bp;
+  uint bn, addr, base, span;
+  int i;
+
+  if(ip->dev == TMPDEV)
+    return tmp_itruncate(ip, size);
+  if(size == 0){
+    itrunc(ip);
+    return 0;
+  }
+  if(!(ip->flags & I_EXTENT) && size > MAXFILE*BSIZE)
+    return -1;
+
+  if(ip->flags & I_INLINE){
+    if(size > INLINESIZE){
+      if(iuninline(ip) < 0)
+        return -1;
+    } else if(size < ip->size){
+      memset((char*)ip->addrs + size, 0, INLINESIZE - size);
+    }
+  }
+
+  if(size < ip->size && !(ip->flags & I_INLINE)){
+    bn = (size + BSIZE - 1) / BSIZE;  // first block to go
+    ip->maplen = 0;
+    idropwindow(ip);
+    while(ip->ndelay > 0 && ip->dstart + ip->ndelay > bn)
+      bundelay(ip->delay[--ip->ndelay]);
+
+    if(ip->flags & I_EXTENT){
+      ext_trunc(ip, (struct extenthdr*)ip->addrs, bn);
+      if(((struct extenthdr*)ip->addrs)->n == 0)
+        memset(ip->addrs, 0, sizeof(ip->addrs));
+    } else {
+      for(i = bn; i < NDIRECT; i++){
+        if(ip->addrs[i]){
+          bfree(ip->dev, ip->addrs[i]);
+          ip->addrs[i] = 0;
+        }
+      }
+      base = NDIRECT;
+      span = NINDIRECT;
+      for(i = 0; i < 3; i++){
+        addr = ip->addrs[NDIRECT + i];
+        if(addr && base >= bn){
+          indfree(ip->dev, addr, i + 1);
+          ip->addrs[NDIRECT + i] = 0;
+        } else if(addr && base + span > bn){
+          if(indtrunc(ip->dev, addr, i + 1, base, bn)){
+            bfree(ip->dev, addr);
+            ip->addrs[NDIRECT + i] = 0;
+          }
+        }
+        base += span;
+        span *= NINDIRECT;
+      }
+    }
+
+    // the rest of the last block reads as zeros if the
+    // file grows again.
+    if(size % BSIZE){
+      if((bp = idelay(ip, size / BSIZE, 0)) != 0){
+        memset(bp->data + size % BSIZE, 0, BSIZE - size % BSIZE);
+      } else if((addr = bmap(ip, size / BSIZE, 0)) != 0){
+        bp = bread(ip->dev, addr);
+        memset(bp->data + size % BSIZE, 0, BSIZE - size % BSIZE);
+        log_write(bp);
+        brelse(bp);
+      }
+    }
+  }
+
+  ip->size = size;
+  iupdate(ip);
+  return 0;
+}
+
+// Give ip disk blocks for file blocks bn..bn+n-1 that have
+// none, without changing its size. Caller holds ip->lock,
+// in a transaction with room for n blocks and WRITESLOP.
+int
+iprealloc(struct inode *ip, uint bn, uint n)
+{
+  uint b;
+
+  if(ip->dev == TMPDEV)
+    return tmp_iprealloc(ip, bn * BSIZE, n * BSIZE);
+  if((ip->flags & I_INLINE) && iuninline(ip) < 0)
+    return -1;
+  for(b = bn; b < bn + n; b++){
+    if(idelay(ip, b, 0) != 0)
+      continue;  // iflush() will see to it
+    if(bmap(ip, b, 1) == 0)
+      return -1;
+  }
+  iupdate(ip);
+  return 0;
+}
+
+// Move inline ip's data out to a block of its own, to make
+// room for more. Returns -1 if out of blocks.
+static int
+iuninline(struct inode *ip)
+{
+  uint data[NADDRS], addr;
+  struct buf *bp;
+
+  memmove(data, ip->addrs, sizeof(data));
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->flags &= ~I_INLINE;
+  if(fsdev(ip->dev)->sb.flags & FS_EXTENT)
+    ip->flags |= I_EXTENT;
+  if(ip->size > 0){
+    if((addr = bmap(ip, 0, 1)) == 0){
+      ip->flags = I_INLINE;
+      memmove(ip->addrs, data, sizeof(data));
+      return -1;
+    }
+    bp = bread(ip->dev, addr);
+    memmove(bp->data, data, ip->size);
+    log_write(bp);
+    brelse(bp);
+  }
+  iupdate(ip);
+  return 0;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -464,34 +1826,70 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// readi() and writei() map the blocks they touch a run at
+// a time, and read each run with one breadn() so that it
+// goes to the disk as one request.
+#define NRUN 8
+
+static char zeroes[BSIZE];
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// Unmapped blocks read as zeros.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, end, addr, run;
+  struct buf *bp[NRUN], *dp;
+  int i, nbp;
 
+  if(ip->dev == TMPDEV)
+    return tmp_readi(ip, user_dst, dst, off, n);
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->flags & I_INLINE){
+    if(either_copyout(user_dst, dst, (char*)ip->addrs + off, n) == -1)
+      return -1;
+    return n;
+  }
+
+  end = off + n;
+  i = nbp = 0;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-      brelse(bp);
+    if(i == nbp && (dp = idelay(ip, off/BSIZE, 0)) != 0){
+      if(either_copyout(user_dst, dst, dp->data + (off % BSIZE), m) == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    if(i == nbp){
+      run = min((end - 1)/BSIZE - off/BSIZE + 1, NRUN);
+      if((addr = bmap_range(ip, off/BSIZE, run, &run, 0)) == 0){
+        if(either_copyout(user_dst, dst, zeroes, m) == -1){
+          tot = -1;
+          break;
+        }
+        continue;
+      }
+      breadn(ip->dev, addr, run, bp);
+      i = 0;
+      nbp = run;
+    }
+    if(either_copyout(user_dst, dst, bp[i]->data + (off % BSIZE), m) == -1) {
       tot = -1;
       break;
     }
-    brelse(bp);
+    brelse(bp[i++]);
   }
+  while(i < nbp)
+    brelse(bp[i++]);
   return tot;
 }
 
@@ -505,35 +1903,71 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, end, addr, run, dsize;
+  struct buf *bp[NRUN], *dp;
+  int i, nbp, mapped;
 
-  if(off > ip->size || off + n < off)
+  if(ip->dev == TMPDEV)
+    return tmp_writei(ip, user_src, src, off, n);
+  if(off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(!(ip->flags & I_EXTENT) && off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->flags & I_INLINE){
+    if(off + n <= INLINESIZE){
+      if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(iuninline(ip) < 0)
+      return -1;
+  }
+
+  dsize = idisksize(ip);
+  mapped = 0;
+  end = off + n;
+  i = nbp = 0;
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
-      brelse(bp);
+    if(i == nbp && (dp = idelay(ip, off/BSIZE, 1)) != 0){
+      if(either_copyin(dp->data + (off % BSIZE), user_src, src, m) == -1)
+        break;
+      continue;
+    }
+    if(i == nbp){
+      // blocks that are already there, or else ones
+      // that can't wait for allocation.
+      run = min((end - 1)/BSIZE - off/BSIZE + 1, NRUN);
+      if((addr = bmap_range(ip, off/BSIZE, run, &run, 0)) == 0 &&
+         (addr = bmap_range(ip, off/BSIZE, run, &run, 1)) == 0)
+        break;
+      mapped = 1;
+      breadn(ip->dev, addr, run, bp);
+      i = 0;
+      nbp = run;
+    }
+    if(either_copyin(bp[i]->data + (off % BSIZE), user_src, src, m) == -1) {
       break;
     }
-    log_write(bp);
-    brelse(bp);
+    log_write(bp[i]);
+    brelse(bp[i++]);
   }
+  while(i < nbp)
+    brelse(bp[i++]);
 
   if(off > ip->size)
     ip->size = off;
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
-  iupdate(ip);
+  // block to ip->addrs[]. a write only to blocks awaiting
+  // allocation changes nothing on disk, though.
+  if(mapped || idisksize(ip) != dsize)
+    iupdate(ip);
 
   return tot;
 }
@@ -546,31 +1980,420 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Indexed directories: see struct dxhdr in fs.h.
+
+// Hash of a name, for the index. mkfs has a copy.
+static uint
+dxhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Read block fbn of directory dp.
+static struct buf*
+dxread(struct inode *dp, uint fbn)
+{
+  uint addr;
+
+  if((addr = bmap(dp, fbn, 0)) == 0)
+    panic("dxread");
+  return bread(dp->dev, addr);
+}
+
+// The index header in bp, which is block fbn.
+static struct dxhdr*
+dxnode(struct buf *bp, uint fbn)
+{
+  if(fbn == 0)
+    return (struct dxhdr*)(bp->data + 2*sizeof(struct dirent));
+  return (struct dxhdr*)bp->data;
+}
+
+// Add a zeroed block to the end of dp. Returns its file
+// block number, or 0 if out of blocks.
+static uint
+dxgrow(struct inode *dp)
+{
+  uint fbn = dp->size / BSIZE;
+  struct buf *bp;
+  uint addr;
+
+  if((addr = bmap(dp, fbn, 1)) == 0)
+    return 0;
+  bp = bread(dp->dev, addr);
+  memset(bp->data, 0, BSIZE);
+  log_write(bp);
+  brelse(bp);
+  dp->size += BSIZE;
+  iupdate(dp);
+  return fbn;
+}
+
+struct dxstep {
+  uint fbn;  // index block
+  int i;     // entry followed
+};
+
+// Find the leaf block for hash h, recording the index entry
+// followed at each level in path[], root first.
+// Returns the number of index levels.
+static int
+dxwalk(struct inode *dp, uint h, struct dxstep *path, uint *leaf)
+{
+  struct buf *bp;
+  struct dxhdr *hd;
+  struct dxentry *e;
+  uint fbn;
+  int lvl, i, depth;
+
+  fbn = 0;
+  depth = 0;
+  for(lvl = 0; lvl <= depth; lvl++){
+    bp = dxread(dp, fbn);
+    hd = dxnode(bp, fbn);
+    e = (struct dxentry*)(hd + 1);
+    if(lvl == 0)
+      depth = hd->depth;
+    if(hd->n == 0 || depth > DXMAXDEPTH)
+      panic("dxwalk");
+    for(i = 1; i < hd->n && e[i].hash <= h; i++)
+      ;
+    path[lvl].fbn = fbn;
+    path[lvl].i = i - 1;
+    fbn = e[i - 1].block;
+    brelse(bp);
+  }
+  *leaf = fbn;
+  return depth + 1;
+}
+
+// If the leaf path[] leads to starts at hash h, entries for
+// h may also be in the leaf before it (see dxlink()): step
+// path[] back to that one and return its block. Otherwise,
+// or if there is none, return 0.
+static uint
+dxcont(struct inode *dp, struct dxstep *path, int nlvl, uint h)
+{
+  struct buf *bp;
+  struct dxhdr *hd;
+  struct dxentry *e;
+  uint fbn;
+  int lvl, cont;
+
+  lvl = nlvl - 1;
+  bp = dxread(dp, path[lvl].fbn);
+  hd = dxnode(bp, path[lvl].fbn);
+  e = (struct dxentry*)(hd + 1);
+  cont = e[path[lvl].i].hash == h;
+  brelse(bp);
+  if(!cont)
+    return 0;
+
+  for(; lvl >= 0 && path[lvl].i == 0; lvl--)
+    ;
+  if(lvl < 0)
+    return 0;
+  path[lvl].i--;
+  for(;; lvl++){
+    bp = dxread(dp, path[lvl].fbn);
+    hd = dxnode(bp, path[lvl].fbn);
+    e = (struct dxentry*)(hd + 1);
+    fbn = e[path[lvl].i].block;
+    brelse(bp);
+    if(lvl == nlvl - 1)
+      return fbn;
+    bp = dxread(dp, fbn);
+    path[lvl + 1].fbn = fbn;
+    path[lvl + 1].i = dxnode(bp, fbn)->n - 1;
+    brelse(bp);
+  }
+}
+
+// Add the entry (h, fbn) to index level lvl of path, after
+// the entry path[lvl].i, splitting index blocks as needed
+// with blocks from spare[]. dxlink() has checked that there
+// are enough.
+static void
+dxinsert(struct inode *dp, struct dxstep *path, int lvl, uint h, uint fbn,
+         uint *spare)
+{
+  struct buf *bp, *nbp;
+  struct dxhdr *hd, *nhd;
+  struct dxentry *e, *ne;
+  uint nfbn, sep;
+  int i, m, k;
+
+  bp = dxread(dp, path[lvl].fbn);
+  hd = dxnode(bp, path[lvl].fbn);
+  e = (struct dxentry*)(hd + 1);
+  i = path[lvl].i + 1;
+
+  if(hd->n < (path[lvl].fbn == 0 ? DXROOT : DXNODE)){
+    memmove(&e[i + 1], &e[i], (hd->n - i) * sizeof(*e));
+    memset(&e[i], 0, sizeof(*e));
+    e[i].hash = h;
+    e[i].block = fbn;
+    hd->n++;
+    log_write(bp);
+    brelse(bp);
+    return;
+  }
+
+  nfbn = *spare++;
+  nbp = dxread(dp, nfbn);
+  nhd = dxnode(nbp, nfbn);
+  ne = (struct dxentry*)(nhd + 1);
+
+  if(lvl == 0){
+    // the root is full: move its entries down into a new
+    // index block, which has room for more.
+    memmove(ne, e, hd->n * sizeof(*e));
+    nhd->n = hd->n;
+    nhd->depth = hd->depth;
+    hd->depth++;
+    hd->n = 1;
+    e[0].block = nfbn;
+    log_write(nbp);
+    log_write(bp);
+    brelse(nbp);
+    brelse(bp);
+    for(k = hd->depth; k > 0; k--)
+      path[k] = path[k - 1];
+    path[0].i = 0;
+    path[1].fbn = nfbn;
+    dxinsert(dp, path, 1, h, fbn, spare);
+    return;
+  }
+
+  // split: the upper half moves to the new block.
+  m = hd->n / 2;
+  memmove(ne, &e[m], (hd->n - m) * sizeof(*e));
+  memset(&e[m], 0, (hd->n - m) * sizeof(*e));
+  nhd->n = hd->n - m;
+  nhd->depth = hd->depth;
+  hd->n = m;
+  sep = ne[0].hash;
+  if(i > m){
+    path[lvl].i = i - m - 1;
+    path[lvl].fbn = nfbn;
+  }
+  log_write(nbp);
+  log_write(bp);
+  brelse(nbp);
+  brelse(bp);
+  dxinsert(dp, path, lvl, h, fbn, spare);
+  dxinsert(dp, path, lvl - 1, sep, nfbn, spare);
+}
+
+// Sort a few hashes.
+static void
+dxsort(uint *h, int n)
+{
+  for(int i = 1; i < n; i++){
+    uint x = h[i];
+    int j;
+    for(j = i; j > 0 && h[j - 1] > x; j--)
+      h[j] = h[j - 1];
+    h[j] = x;
+  }
+}
+
+// Write a new directory entry into indexed directory dp.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct dxstep path[DXMAXDEPTH + 1];
+  struct buf *bp, *nbp;
+  struct dxhdr *hd;
+  struct dirent *de, *nde;
+  uint h = dxhash(name), hs[DPB], sorted[DPB], leaf, split, nleaf;
+  uint spare[DXMAXDEPTH + 2], size;
+  int nlvl, lvl, i, j, need, keep;
+
+  for(;;){
+    nlvl = dxwalk(dp, h, path, &leaf);
+    bp = dxread(dp, leaf);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB; i++)
+      if(de[i].inum == 0)
+        break;
+    if(i < DPB){
+      de[i].inum = inum;
+      strncpy(de[i].name, name, DIRSIZ);
+      log_write(bp);
+      brelse(bp);
+      return 0;
+    }
+
+    // the leaf is full. split it where the hash changes,
+    // nearest the middle.
+    for(i = 0; i < DPB; i++)
+      sorted[i] = hs[i] = dxhash(de[i].name);
+    brelse(bp);
+    dxsort(sorted, DPB);
+    split = 0;
+    keep = 0;
+    for(i = 0; i < DPB/2 && split == 0; i++){
+      if(sorted[DPB/2 + i] != sorted[DPB/2 + i - 1])
+        split = sorted[DPB/2 + i];
+      else if(sorted[DPB/2 - i] != sorted[DPB/2 - i - 1])
+        split = sorted[DPB/2 - i];
+    }
+    if(split == 0){
+      // all one hash. split between it and h if they
+      // differ; if not, start a continuation leaf for h
+      // after this one, which dirlookup() also searches.
+      split = h > sorted[0] ? h : sorted[0];
+      keep = h >= sorted[0];
+    }
+
+    // one block for the new leaf, and one for each full
+    // index block on the way down.
+    need = 1;
+    for(lvl = nlvl - 1; lvl >= 0; lvl--){
+      bp = dxread(dp, path[lvl].fbn);
+      hd = dxnode(bp, path[lvl].fbn);
+      j = hd->n < (lvl == 0 ? DXROOT : DXNODE);
+      if(lvl == 0 && !j && hd->depth >= DXMAXDEPTH){
+        brelse(bp);
+        return -1;
+      }
+      brelse(bp);
+      if(j)
+        break;
+      need++;
+    }
+    size = dp->size;
+    for(i = 0; i < need; i++){
+      if((spare[i] = dxgrow(dp)) == 0){
+        itruncate(dp, size);
+        return -1;
+      }
+    }
+
+    nleaf = spare[0];
+    dxinsert(dp, path, nlvl - 1, split, nleaf, spare + 1);
+
+    bp = dxread(dp, leaf);
+    nbp = dxread(dp, nleaf);
+    de = (struct dirent*)bp->data;
+    nde = (struct dirent*)nbp->data;
+    for(i = j = 0; i < DPB && !keep; i++){
+      if(hs[i] >= split){
+        nde[j++] = de[i];
+        memset(&de[i], 0, sizeof(de[i]));
+      }
+    }
+    log_write(nbp);
+    log_write(bp);
+    brelse(nbp);
+    brelse(bp);
+  }
+}
+
+// Turn dp, a full one-block linear directory, into an indexed
+// one: block 0 becomes the root of the index, and the entries
+// other than "." and ".." move to a leaf in block 1.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *bp, *lbp;
+  struct dirent *de;
+  struct dxhdr *hd;
+  struct dxentry *e;
+  uint leaf;
+
+  bp = dxread(dp, 0);
+  de = (struct dirent*)bp->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0){
+    brelse(bp);
+    return -1;
+  }
+  brelse(bp);
+
+  if((leaf = dxgrow(dp)) == 0)
+    return -1;
+  bp = dxread(dp, 0);
+  lbp = dxread(dp, leaf);
+  memmove(lbp->data, bp->data + 2*sizeof(struct dirent),
+          BSIZE - 2*sizeof(struct dirent));
+  memset(bp->data + 2*sizeof(struct dirent), 0, BSIZE - 2*sizeof(struct dirent));
+  hd = dxnode(bp, 0);
+  hd->n = 1;
+  e = (struct dxentry*)(hd + 1);
+  e[0].block = leaf;
+  log_write(lbp);
+  log_write(bp);
+  brelse(lbp);
+  brelse(bp);
+  dp->flags |= I_DXDIR;
+  iupdate(dp);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, end, inum, leaf, h;
   struct dirent de;
+  struct inode *ip;
+  struct dxstep path[DXMAXDEPTH + 1];
+  int nlvl;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  // the cache doesn't know offsets.
+  if(poff == 0 && dcache_lookup(dp, name, &ip))
+    return ip;
+
+  // an indexed directory has the name in one leaf,
+  // or in the root if it is "." or "..". a leaf whose
+  // index entry is the name's own hash may continue one
+  // before it, and so on back.
+  off = 0;
+  end = dp->size;
+  nlvl = 0;
+  h = 0;
+  if(dp->flags & I_DXDIR){
+    if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+      end = 2*sizeof(de);
+    } else {
+      h = dxhash(name);
+      nlvl = dxwalk(dp, h, path, &leaf);
+      off = leaf * BSIZE;
+      end = off + BSIZE;
+    }
+  }
+
+  for(;;){
+    for(; off < end; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlookup read");
+      if(de.inum == 0)
+        continue;
+      if(namecmp(name, de.name) == 0){
+        // entry matches path element
+        if(poff)
+          *poff = off;
+        inum = de.inum;
+        dcache_enter(dp, name, inum);
+        return iget(dp->dev, inum);
+      }
     }
+    if(nlvl == 0 || (leaf = dxcont(dp, path, nlvl, h)) == 0)
+      break;
+    off = leaf * BSIZE;
+    end = off + BSIZE;
   }
 
+  dcache_enter(dp, name, 0);
   return 0;
 }
 
@@ -589,6 +2412,13 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dp->flags & I_DXDIR){
+    if(dxlink(dp, name, inum) < 0)
+      return -1;
+    dcache_enter(dp, name, inum);
+    return 0;
+  }
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -597,10 +2427,16 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // index a directory about to outgrow its first block.
+  if(off == BSIZE && dp->size == BSIZE && dp->dev != TMPDEV &&
+     (fsdev(dp->dev)->sb.flags & FS_DXDIR) && dxconvert(dp) == 0)
+    return dirlink(dp, name, inum);
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcache_enter(dp, name, inum);
 
   return 0;
 }
@@ -644,14 +2480,90 @@ skipelem(char *path, char *name)
   return path;
 }
 
+static struct mount*
+mfind(struct inode *ip, int root)
+{
+  struct mount *m;
+  struct inode *x;
+
+  for(m = mtable.m; m < mtable.m + NMOUNT; m++){
+    if(m->on == 0)
+      continue;
+    x = root ? m->root : m->on;
+    if(x->dev == ip->dev && x->inum == ip->inum)
+      return m;
+  }
+  return 0;
+}
+
+// Mount the file system on device dev over directory ip.
+// On success the mount keeps the caller's reference to ip.
+// dev is tmpfs (TMPDEV) or a disk other than the root's,
+// and each can be mounted only once.
+// Needs no transaction: fsinit() only reads, and initlog()
+// writes the recovered blocks in place, outside the log.
+int
+mount(struct inode *ip, uint dev)
+{
+  struct mount *m, *free;
+  struct inode *root;
+  int busy;
+
+  if(dev != TMPDEV && (dev == ROOTDEV || !bdevpresent(dev)))
+    return -1;
+  ilock(ip);
+  if(ip->type != T_DIR || ip->dev == dev){
+    iunlock(ip);
+    return -1;
+  }
+  iunlock(ip);
+
+  // entries are only added, so a free slot found here stays
+  // free while mounting is held.
+  acquiresleep(&mtable.mounting);
+  acquire(&mtable.lock);
+  busy = mfind(ip, 0) != 0;
+  free = 0;
+  for(m = mtable.m; m < mtable.m + NMOUNT; m++){
+    if(m->on && m->root->dev == dev)
+      busy = 1;
+    else if(m->on == 0 && free == 0)
+      free = m;
+  }
+  release(&mtable.lock);
+  if(busy || free == 0 || (dev != TMPDEV && fsinit(dev) < 0)){
+    releasesleep(&mtable.mounting);
+    return -1;
+  }
+
+  root = iget(dev, ROOTINO);
+  acquire(&mtable.lock);
+  free->root = root;
+  __sync_synchronize();
+  free->on = ip;
+  release(&mtable.lock);
+  releasesleep(&mtable.mounting);
+  return 0;
+}
+
+// Is ip a directory something is mounted on?
+int
+ismount(struct inode *ip)
+{
+  return mfind(ip, 0) != 0;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
-// Must be called inside a transaction since it calls iput().
+// Holds no locks at its iput()s, so it may be called
+// outside a transaction; callers look a path up before
+// they begin_op() on the device it leads to.
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct mount *m;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -659,6 +2571,20 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    // leave a mounted file system's root for the
+    // directory it covers, and look up ".." there.
+    if(namecmp(name, "..") == 0 && (m = mfind(ip, 1)) != 0){
+      iput(ip);
+      ip = idup(m->on);
+    }
+    if(!(nameiparent && *path == '\0') && dcache_lookup(ip, name, &next)){
+      // only directories have entries, so no need to lock ip.
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      goto cross;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -675,6 +2601,12 @@ namex(char *path, int nameiparent, char *name)
     }
     iunlockput(ip);
     ip = next;
+  cross:
+    // and enter one at the directory it covers.
+    if((m = mfind(ip, 0)) != 0){
+      iput(ip);
+      ip = idup(m->root);
+    }
   }
   if(nameiparent){
     iput(ip);
@@ -8,6 +8,8 @@
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
 //                                          free bit map | data blocks]
+// With the log on another device (sb.logdev), there is no log here;
+// the log is at sb.logstart on that device, past its own file system.
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,13 +22,58 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint flags;        // FS_EXTENT, FS_DXDIR, FS_INLINE
+  uint logdev;       // Device the log is on, or 0 for this one
 };
 
 #define FSMAGIC 0x10203040
 
+// superblock flags
+#define FS_EXTENT 0x1  // new inodes are extent-mapped
+#define FS_DXDIR  0x2  // directories that outgrow a block are indexed
+#define FS_INLINE 0x4  // small files are kept in the inode
+
+#define NADDRS 28  // words of block map in an inode
+
+// Block-mapped inodes: addrs[] holds NDIRECT block
+// addresses, then the addresses of a single, a double and
+// a triple indirect block.
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
+
+// Extent-mapped inodes (I_EXTENT): addrs[] holds the root of
+// a tree of extents, each a run of consecutive disk blocks.
+// A node is a header and entries sorted by lblk. In the
+// leaves (depth 0) the entries are extents; above them each
+// entry points to a node block one level down, whose entries
+// start at its lblk. The root holds NEXTROOT entries, node
+// blocks NEXTNODE.
+struct extenthdr {
+  ushort n;      // entries in use
+  ushort depth;  // levels of nodes below this one
+};
+
+struct extent {
+  uint lblk;     // first file block
+  uint start;    // first disk block, or node block
+  uint len;      // number of blocks; 0 in index entries
+};
+
+#define NEXTROOT ((NADDRS*sizeof(uint) - sizeof(struct extenthdr)) / sizeof(struct extent))
+#define NEXTNODE ((BSIZE - sizeof(struct extenthdr)) / sizeof(struct extent))
+
+// dinode flags
+#define I_EXTENT 0x1  // addrs[] is an extent tree
+#define I_DXDIR  0x2  // directory has a hash index
+#define I_INLINE 0x4  // addrs[] holds the file's data
+
+// An inline file's contents, up to INLINESIZE bytes, are
+// kept in addrs[] and cost no blocks. A file that grows
+// past that gets a block map like any other.
+#define INLINESIZE (NADDRS * sizeof(uint))
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +82,9 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  ushort flags;         // I_EXTENT, I_DXDIR, I_INLINE
+  ushort pad;
+  uint addrs[NADDRS];   // Data block addresses, extent tree, or data
 };
 
 // Inodes per block.
@@ -58,3 +107,35 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+#define DPB (BSIZE / sizeof(struct dirent))  // dirents per block
+
+// An indexed directory (I_DXDIR) keeps its dirents in leaf
+// blocks, and finds the one for a name by a hash of the name
+// through a tree of index blocks. Block 0 is the root: the
+// dirents for "." and "..", a dxhdr, and DXROOT entries. Other
+// index blocks are a dxhdr and DXNODE entries. Entries are
+// sorted by hash; each points to the block for the hashes
+// from its own up to the next entry's. A leaf too full of one
+// hash to split is continued in the next, whose entry repeats
+// that hash. The index is laid out
+// in dirent-sized slots that start with a zero inum, so the
+// directory still reads as an array of dirents, some free.
+struct dxhdr {
+  ushort zero;
+  ushort depth;  // levels of index blocks below this one
+  ushort n;      // entries in use
+  ushort pad[5];
+};
+
+struct dxentry {
+  ushort zero;
+  ushort pad;
+  uint hash;     // least hash in the block
+  uint block;    // file block number
+  uint pad2;
+};
+
+#define DXROOT (DPB - 3)
+#define DXNODE (DPB - 1)
+#define DXMAXDEPTH 3
+
@@ -0,0 +1,335 @@
+//
+// I/O scheduler: the queue between the buffer cache and the
+// disk driver.
+//
+// bsubmit() adds bufs here. The driver pulls requests out with
+// iosched_next() whenever it has room in flight -- when a
+// caller kicks it, and again from the completion interrupt --
+// so requests that arrive while the disk is busy pile up here
+// and can be reordered and merged before they are issued.
+//
+// Each policy hands back a run of bufs, linked through qnext,
+// that have the same direction and consecutive block numbers;
+// the driver turns a run into one multi-block request.
+//
+// Each disk has a queue of its own, so requests for one
+// don't wait behind, or get merged with, those for another.
+//
+// Policies:
+//   noop     -- arrival order; merges a run only if its blocks
+//               were also submitted back to back.
+//   deadline -- per-direction queues sorted by block number,
+//               served as an ascending sweep in batches. Reads
+//               are preferred, a read that has waited longer
+//               than READ_EXPIRE is served next regardless of
+//               position, and writes get a turn after at most
+//               WRITES_STARVED read batches (or on WRITE_EXPIRE),
+//               so a burst of commit() writes can't hold reads
+//               off for long, nor the other way around.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "sysctl.h"
+
+#define READ_EXPIRE     2   // ticks
+#define WRITE_EXPIRE   20   // ticks
+#define FIFO_BATCH     16   // blocks per sweep before re-checking
+#define WRITES_STARVED  2   // read batches before writes get a turn
+
+struct ioqueue;
+
+struct iopolicy {
+  char *name;
+  void (*add)(struct ioqueue*, struct buf*);
+  // a run of at most n bufs, or 0
+  struct buf *(*next)(struct ioqueue*, int n);
+};
+
+struct ioqueue {
+  struct spinlock lock;
+  struct iopolicy *policy;
+  int nqueued;
+
+  // arrival order, linked both ways through fnext and fprev.
+  // noop uses fifo[0] for everything; deadline has one per
+  // direction, indexed by b->write.
+  struct buf *fifo[2];
+  struct buf *ftail[2];
+
+  // deadline: queued bufs sorted by block number, linked
+  // both ways through qnext and qprev, one list per direction.
+  struct buf *sorted[2];
+  struct buf *hint[2];  // the last buf added, where the next add looks first
+  struct buf *cur[2];   // where the sweep resumes: first buf past pos[], or 0
+  int dir;       // direction of the current batch
+  int batch;     // blocks left in the current batch
+  uint pos[2];   // where the sweep in each direction has reached
+  int starved;   // read batches since writes were last served
+} ioqs[NDISK];
+
+// Append b to arrival-order list d.
+static void
+fifo_add(struct ioqueue *q, int d, struct buf *b)
+{
+  b->fnext = 0;
+  b->fprev = q->ftail[d];
+  if(q->ftail[d])
+    q->ftail[d]->fnext = b;
+  else
+    q->fifo[d] = b;
+  q->ftail[d] = b;
+}
+
+static void
+fifo_del(struct ioqueue *q, int d, struct buf *b)
+{
+  if(b->fprev)
+    b->fprev->fnext = b->fnext;
+  else
+    q->fifo[d] = b->fnext;
+  if(b->fnext)
+    b->fnext->fprev = b->fprev;
+  else
+    q->ftail[d] = b->fprev;
+  b->fnext = b->fprev = 0;
+}
+
+static void
+noop_add(struct ioqueue *q, struct buf *b)
+{
+  fifo_add(q, 0, b);
+}
+
+static struct buf*
+noop_next(struct ioqueue *q, int max)
+{
+  struct buf *first, *last;
+  int n;
+
+  if((first = q->fifo[0]) == 0)
+    return 0;
+  last = first;
+  for(n = 1; n < max; n++){
+    struct buf *b = last->fnext;
+    if(b == 0 || b->write != first->write || b->blockno != last->blockno + 1)
+      break;
+    last->qnext = b;
+    last = b;
+  }
+  while(q->fifo[0] != last)
+    fifo_del(q, 0, q->fifo[0]);
+  fifo_del(q, 0, last);
+  last->qnext = 0;
+  return first;
+}
+
+// A commit's writes and a sequential reader's reads arrive
+// mostly in ascending order, so the place for b is usually
+// just after the last buf added, and the search starts there.
+static void
+deadline_add(struct ioqueue *q, struct buf *b)
+{
+  struct buf *p, *n;
+  int dir = b->write;
+
+  for(p = q->hint[dir]; p && p->blockno >= b->blockno; p = p->qprev)
+    ;
+  n = p ? p->qnext : q->sorted[dir];
+  while(n && n->blockno < b->blockno){
+    p = n;
+    n = n->qnext;
+  }
+  b->qprev = p;
+  b->qnext = n;
+  if(p)
+    p->qnext = b;
+  else
+    q->sorted[dir] = b;
+  if(n)
+    n->qprev = b;
+  q->hint[dir] = b;
+  if(b->blockno >= q->pos[dir] && (q->cur[dir] == 0 || b->blockno <= q->cur[dir]->blockno))
+    q->cur[dir] = b;
+  fifo_add(q, dir, b);
+}
+
+static int
+expired(struct ioqueue *q, int dir, int limit)
+{
+  struct buf *b = q->fifo[dir];
+  return b && ticks - b->qtime >= limit;
+}
+
+// Choose the direction of a new batch, and where it starts.
+static struct buf*
+deadline_start(struct ioqueue *q)
+{
+  int dir;
+
+  if(q->sorted[0] == 0 && q->sorted[1] == 0)
+    return 0;
+
+  if(q->sorted[0] && q->sorted[1] == 0)
+    dir = 0;
+  else if(q->sorted[0] == 0)
+    dir = 1;
+  else if(q->starved >= WRITES_STARVED || expired(q, 1, WRITE_EXPIRE))
+    dir = 1;
+  else
+    dir = 0;
+
+  if(dir == 0 && q->sorted[1])
+    q->starved++;
+  else if(dir == 1)
+    q->starved = 0;
+  q->dir = dir;
+  q->batch = FIFO_BATCH;
+
+  // serve an expired request first; otherwise carry on
+  // sweeping up from where this direction left off.
+  if(expired(q, dir, dir ? WRITE_EXPIRE : READ_EXPIRE))
+    return q->fifo[dir];
+  if(q->cur[dir])
+    return q->cur[dir];
+  return q->sorted[dir];
+}
+
+static struct buf*
+deadline_next(struct ioqueue *q, int max)
+{
+  struct buf *b, *first, *last;
+  int dir, n;
+
+  first = 0;
+  dir = q->dir;
+  if(q->batch > 0 && q->sorted[dir] && !expired(q, 0, READ_EXPIRE))
+    first = q->cur[dir];
+  if(first == 0){
+    if((first = deadline_start(q)) == 0)
+      return 0;
+    dir = q->dir;
+  }
+
+  // unlink first and the adjacent bufs after it.
+  last = first;
+  for(n = 1; n < max; n++){
+    b = last->qnext;
+    if(b == 0 || b->blockno != last->blockno + 1)
+      break;
+    last = b;
+  }
+  if(first->qprev)
+    first->qprev->qnext = last->qnext;
+  else
+    q->sorted[dir] = last->qnext;
+  if(last->qnext)
+    last->qnext->qprev = first->qprev;
+  q->pos[dir] = last->blockno + 1;
+  q->cur[dir] = last->qnext;
+  for(b = first; b; b = b == last ? 0 : b->qnext){
+    fifo_del(q, dir, b);
+    if(b == q->hint[dir])
+      q->hint[dir] = 0;
+  }
+  first->qprev = 0;
+  last->qnext = 0;
+
+  q->batch -= n;
+  return first;
+}
+
+static struct iopolicy policies[] = {
+  [IOSCHED_NOOP]     { "noop", noop_add, noop_next },
+  [IOSCHED_DEADLINE] { "deadline", deadline_add, deadline_next },
+};
+
+void
+ioschedinit(void)
+{
+  struct ioqueue *q;
+
+  for(q = ioqs; q < ioqs + NDISK; q++){
+    initlock(&q->lock, "iosched");
+    q->policy = &policies[IOSCHED];
+  }
+}
+
+// The queue for device dev.
+static struct ioqueue*
+devq(uint dev)
+{
+  if(dev < DISKDEV || dev >= DISKDEV + NDISK)
+    panic("iosched: dev");
+  return &ioqs[dev - DISKDEV];
+}
+
+// Queue b for a read (write=0) or write.
+void
+iosched_add(struct buf *b, int write)
+{
+  struct ioqueue *q = devq(b->dev);
+
+  acquire(&q->lock);
+  b->disk = 1;
+  b->write = write;
+  b->qtime = ticks;
+  b->qnext = 0;
+  q->policy->add(q, b);
+  q->nqueued++;
+  release(&q->lock);
+}
+
+// Called by the driver: the next run of at most max bufs for
+// device dev to issue as one request, linked through qnext,
+// or 0 if none.
+struct buf*
+iosched_next(uint dev, int max)
+{
+  struct ioqueue *q = devq(dev);
+  struct buf *b, *r;
+
+  acquire(&q->lock);
+  if((r = q->policy->next(q, max)) != 0)
+    for(b = r; b; b = b->qnext)
+      q->nqueued--;
+  release(&q->lock);
+  return r;
+}
+
+// Switch every queue to policy p, moving any queued requests
+// over; p == -1 just looks. Returns the previous policy, or
+// -1 if p is not a policy.
+int
+iosched_select(int p)
+{
+  struct iopolicy *old;
+  struct ioqueue *q;
+  struct buf *b, *nb;
+
+  if(p < -1 || p >= NELEM(policies))
+    return -1;
+  old = ioqs[0].policy;
+  for(q = ioqs; q < ioqs + NDISK; q++){
+    acquire(&q->lock);
+    if(p >= 0 && q->policy != &policies[p]){
+      struct iopolicy *was = q->policy;
+      q->policy = &policies[p];
+      while((b = was->next(q, 1)) != 0){
+        for(; b; b = nb){
+          nb = b->qnext;
+          b->qnext = 0;
+          q->policy->add(q, b);
+        }
+      }
+    }
+    release(&q->lock);
+  }
+  return old - policies;
+}
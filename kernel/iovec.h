@@ -0,0 +1,9 @@
+// Vectored I/O: readv() and writev() take an array of these.
+// Both the kernel and user programs use this header file.
+
+#define IOV_MAX 16  // most buffers in one call
+
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
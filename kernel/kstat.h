@@ -0,0 +1,20 @@
+// Kernel performance counters, returned by kstat().
+// Both the kernel and user programs use this header file.
+
+#define NLATBUCKET 64
+
+struct kstat {
+  uint64 diskreqs;    // requests issued to the disk
+  uint64 diskblocks;  // blocks moved by those requests
+  uint64 diskpolled;  // waits that ended while polling
+  uint64 readahead;   // blocks read ahead into the buffer cache
+  uint64 commits;     // log transactions committed
+  uint64 dcachehits;  // lookups the dcache found present
+  uint64 dcacheneg;   // lookups the dcache found absent
+  uint64 dcachemisses;  // lookups the dcache didn't know
+  // histogram of disk wait latency, from sending a request to
+  // its waiter seeing it done, in microseconds. bucket i < 4
+  // holds i us; above that each power of two is split into
+  // four buckets: see latbucket() in virtio_disk.c.
+  uint64 disklat[NLATBUCKET];
+};
@@ -3,9 +3,11 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -15,191 +17,691 @@
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
-// A system call should call begin_op()/end_op() to mark
+// A system call should call begin_op(dev)/end_op(dev) to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// the count of in-progress FS system calls and reserves
+// log space for MAXOPBLOCKS blocks. But if it thinks the log
+// is close to running out, it sleeps until the last
+// outstanding end_op() commits. A call that writes more
+// uses begin_opn(n)/end_opn(n) to reserve n blocks, up to
+// log_opmax().
+//
+// There are two in-memory transactions. When the last
+// outstanding operation of the open transaction ends, that
+// end_op() closes it: it copies the transaction's blocks out
+// of the cache and opens a fresh transaction, which new
+// operations join while the closed one is written to the log.
+// Only the copy holds up begin_op(). end_op() returns once its
+// own transaction has committed; operations that end while
+// the previous transaction is still committing wait, and are
+// committed together by whichever of them ends up closing the
+// next one (group commit).
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// The on-disk log is two slots, each with room for one
+// transaction:
+//   header block, containing a sequence number, a checksum,
+//     and block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Transactions that reach the disk go to alternate slots.
+// commit() writes the blocks and the header in one batch, in
+// no particular order; the transaction has committed once
+// all of them are on disk, which is when the header's
+// checksum matches. Recovery replays the valid transaction
+// with the highest sequence number. A slot is only reused
+// after the transaction in it, and the one in the other slot,
+// have been installed, so there is never a need to erase a
+// header, and replaying the newest transaction again is
+// harmless.
+//
+// The size of the log comes from the superblock. A transaction
+// holds as many blocks as fit in a slot, in a header block,
+// and in the buffer cache (which must be able to pin three
+// transactions at once), whichever is least.
+//
+// Installing the blocks at their home locations is left to
+// the logflush kernel thread. The next commit waits for that;
+// meanwhile new FS system calls can run. The committed blocks
+// stay pinned in the cache until they have been installed.
+//
+// With a commit interval set (sysctl CTL_COMMIT), end_op()
+// doesn't wait for a commit: the open transaction gathers
+// operations until it is interval ticks old, when the logtimer
+// kernel thread commits it, or until it fills up, when the
+// begin_op() that finds no room commits it. A crash can lose
+// the operations of that long, but each is still all or
+// nothing. log_force(), for fsync(), commits early.
+//
+// Each disk file system has a log of its own, in logs[]; the
+// root's is logs[0]. begin_op(dev) joins the open transaction
+// of dev's log only, and a call may only write to that
+// device; tmpfs has no log, so a call on it joins nothing.
+// Calls that start from a path look it up first, outside any
+// transaction, to learn the device. Each log commits and
+// installs independently of the others: a call on one file
+// system never waits for another's log. iput() may have to
+// free an inode on a device the call hasn't joined; it does
+// that in a transaction of its own (see iput()).
+//
+// A file system's log is normally in its own log blocks, but
+// its superblock can name another device to keep it on
+// (sb.logdev), so that commits don't compete with the file
+// system's own I/O, or go to a device better at sequential
+// writes. The log's blocks are then sb.logstart onwards on
+// that device, past the end of any file system there.
+
+// most blocks a header block can list.
+#define LOGMAX ((BSIZE - 3*sizeof(int)) / sizeof(int) - 1)
+#define LOGHASH 64  // buckets in the open transaction's index
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
+  uint seq;    // transaction number
+  uint cksum;  // of seq, n, block[], and the blocks' contents
   int n;
-  int block[LOGSIZE];
+  int block[LOGMAX];
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // most blocks in one transaction.
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
-  int dev;
-  struct logheader lh;
+  int reserved;    // log blocks they have reserved.
+  int closing;     // copying out the closed transaction, please wait.
+  int committing;  // writing the closed transaction to the log.
+  int installing;  // logflush is installing ilh.
+  int seq;         // number of the open transaction.
+  int done;        // transactions up to this one have committed.
+  int iset;        // log->logbuf[] set that ilh's blocks are in.
+  int slot;        // log slot the next commit writes.
+  int interval;    // ticks between commits; 0 commits each op.
+  uint opened;     // ticks when lh got its first block.
+  uint64 ncommit;  // transactions written to the log.
+  int dev;         // 0 if no file system uses this log.
+  int ldev;        // device the log blocks are on: dev, or sb.logdev.
+  uint fssize;     // blocks of dev's file system.
+  struct logheader lh;   // the open transaction
+  struct logheader clh;  // the closed transaction being committed
+  struct logheader ilh;  // the committed transaction being installed
+
+  // hash index over lh.block[], for log absorption:
+  // chains of indexes into lh.block[], -1 terminated.
+  short hhead[LOGHASH];
+  short hnext[LOGMAX];
+
+  // Private copies of the blocks of the committing and the
+  // installing transactions, written to the log and then to
+  // their home locations. Outside the buffer cache, so a commit
+  // never competes with file system calls for cache buffers.
+  // Allocated by initlog(), cap per set.
+  struct buf *logbuf[2][LOGMAX];
+  struct buf loghead;  // header of the committing transaction
 };
-struct log log;
+struct log logs[NDISK];
 
-static void recover_from_log(void);
-static void commit();
+#define SLOTSIZE(log) ((log)->size / 2)
 
+static void recover_from_log(struct log*);
+static void commit(struct log*, int);
+static void logflush(void*);
+static void logtimer(void*);
+static void hashclear(struct log*);
+
+// Set up the unused logs, and their threads.
 void
-initlog(int dev, struct superblock *sb)
+loginit(void)
 {
+  struct log *log;
+
   if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
+    panic("loginit: too big logheader");
+
+  for (log = logs; log < logs + NDISK; log++) {
+    initlock(&log->lock, "log");
+    hashclear(log);
+    kthread(logflush, log, "logflush");
+    kthread(logtimer, log, "logtimer");
+  }
+}
+
+// The log of device dev, or 0 if it has none.
+static struct log*
+findlog(uint dev)
+{
+  struct log *log;
+
+  for (log = logs; log < logs + NDISK; log++)
+    if (log->dev == dev)
+      return log;
+  return 0;
+}
+
+static struct log*
+devlog(uint dev)
+{
+  struct log *log;
+
+  if ((log = findlog(dev)) == 0)
+    panic("no log");
+  return log;
+}
+
+// Would a log of nlog blocks at start on device ldev, for the
+// file system of fssize blocks on dev, overlap a file system
+// or a log already in use?
+static int
+overlaps(int dev, uint fssize, int ldev, uint start, uint nlog)
+{
+  struct log *l;
+
+  for (l = logs; l < logs + NDISK; l++) {
+    if (l->dev == 0)
+      continue;
+    if (l->dev == ldev && start < l->fssize)
+      return 1;  // on the file system there
+    if (l->ldev == dev && l->start < fssize)
+      return 1;  // that log is on dev's file system
+    if (l->ldev == ldev && start < l->start + l->size &&
+        l->start < start + nlog)
+      return 1;
+  }
+  return 0;
+}
+
+// Start using a log for the file system on dev, whose
+// superblock is sb, recovering any committed transaction.
+// Returns -1 if its log is too small, on a device that isn't
+// there or is in use where the log would go, or if there's
+// no free log.
+int
+initlog(int dev, struct superblock *sb)
+{
+  struct log *log;
+  int s, i, per, cap, ldev;
+  char *page = 0;
+
+  for (log = logs; log < logs + NDISK && log->dev; log++)
+    ;
+  if (log == logs + NDISK)
+    return -1;
+
+  ldev = dev;
+  if (sb->logdev != 0) {
+    ldev = sb->logdev;
+    if (ldev == dev || ldev == TMPDEV || !bdevpresent(ldev))
+      return -1;
+  }
+  if (overlaps(dev, sb->size, ldev, sb->logstart, sb->nlog))
+    return -1;
 
-  initlock(&log.lock, "log");
-  log.start = sb->logstart;
-  log.size = sb->nlog;
-  log.dev = dev;
-  recover_from_log();
+  // every log must take the largest operation the first does,
+  // and the buffer cache must hold three transactions of each.
+  cap = sb->nlog / 2 - 1;
+  if (cap > LOGMAX)
+    cap = LOGMAX;
+  if (cap > (NBUF - MAXOPBLOCKS - NDELAYBUF) / (3 * NDISK))
+    cap = (NBUF - MAXOPBLOCKS - NDELAYBUF) / (3 * NDISK);
+  if (cap < MAXOPBLOCKS || (log != logs && cap < logs[0].cap))
+    return -1;
+
+  acquire(&log->lock);
+  log->dev = dev;
+  log->ldev = ldev;
+  log->fssize = sb->size;
+  log->start = sb->logstart;
+  log->size = sb->nlog;
+  log->cap = cap;
+  log->interval = logs[0].interval;
+  release(&log->lock);
+
+  per = PGSIZE / sizeof(struct buf);
+  for (s = 0; s < 2; s++) {
+    for (i = 0; i < log->cap; i++) {
+      if (i % per == 0) {
+        if ((page = kalloc()) == 0)
+          panic("initlog: kalloc");
+        memset(page, 0, PGSIZE);
+      }
+      log->logbuf[s][i] = (struct buf *) page + i % per;
+    }
+  }
+
+  recover_from_log(log);
+  return 0;
+}
+
+// Empty the open transaction's block index.
+static void
+hashclear(struct log *log)
+{
+  for (int i = 0; i < LOGHASH; i++)
+    log->hhead[i] = -1;
+}
+
+// FNV-1a, a word at a time.
+static uint
+cksum(uint h, void *p, int n)
+{
+  uint *w = p;
+
+  for (int i = 0; i < n / sizeof(uint); i++) {
+    h ^= w[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Checksum of a transaction whose blocks are in bufs[].
+static uint
+trans_cksum(struct logheader *lh, struct buf **bufs)
+{
+  uint h = 2166136261;
+  int tail;
+
+  h = cksum(h, &lh->seq, sizeof(lh->seq));
+  h = cksum(h, &lh->n, sizeof(lh->n));
+  h = cksum(h, lh->block, lh->n * sizeof(lh->block[0]));
+  for (tail = 0; tail < lh->n; tail++)
+    h = cksum(h, bufs[tail]->data, BSIZE);
+  return h;
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks, in bufs[], to their home location.
 static void
-install_trans(int recovering)
+install_trans(struct log *log, struct logheader *lh, struct buf **bufs, int recovering)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
+  // Recovery runs before anything but the superblock and the
+  // log has been read, so no cached copy of a home block can
+  // go stale by being written around the cache.
+  for (tail = 0; tail < lh->n; tail++) {
+    bufs[tail]->dev = log->dev;
+    bufs[tail]->blockno = lh->block[tail];
+    bsubmit(bufs[tail], 1);  // write dst to disk
+  }
+  bkick();
+  for (tail = 0; tail < lh->n; tail++) {
+    bwait(bufs[tail]);
+    if(recovering == 0){
+      struct buf *dbuf = bread(log->dev, lh->block[tail]); // still cached
       bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+      brelse(dbuf);
+    }
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the transaction in log slot s into lh and bufs[].
+// Returns 1 if it is complete and intact, 0 if not.
+static int
+read_trans(struct log *log, int s, struct logheader *lh, struct buf **bufs)
+{
+  uint base = log->start + s * SLOTSIZE(log);
+  struct buf *buf = bread(log->ldev, base);
+  int tail;
+
+  *lh = *(struct logheader *) (buf->data);
+  brelse(buf);
+  if (lh->n < 0 || lh->n > log->cap)
+    return 0;
+  for (tail = 0; tail < lh->n; tail++) {
+    bufs[tail]->dev = log->ldev;
+    bufs[tail]->blockno = base + tail + 1;
+    bsubmit(bufs[tail], 0); // read log block
+  }
+  bkick();
+  for (tail = 0; tail < lh->n; tail++)
+    bwait(bufs[tail]);
+  return trans_cksum(lh, bufs) == lh->cksum;
+}
+
 static void
-read_head(void)
+recover_from_log(struct log *log)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  // too big for the stack; nothing else uses these yet.
+  struct logheader *h[2] = { &log->clh, &log->ilh };
+  int s, best;
+
+  best = -1;
+  for (s = 0; s < 2; s++) {
+    if (read_trans(log, s, h[s], log->logbuf[s]) &&
+        (best < 0 || h[s]->seq > h[best]->seq))
+      best = s;
   }
-  brelse(buf);
+  if (best >= 0)
+    install_trans(log, h[best], log->logbuf[best], 1); // copy from log to disk
+
+  acquire(&log->lock);
+  log->slot = 0;
+  log->seq = 1;
+  if (best >= 0) {
+    log->slot = 1 - best;  // don't overwrite the newest
+    log->seq = h[best]->seq + 1;
+  }
+  log->done = log->seq - 1;
+  log->lh.n = 0;
+  release(&log->lock);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// The logflush kernel thread: install each committed
+// transaction, freeing the log for the next commit.
 static void
-write_head(void)
+logflush(void *arg)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  struct log *log = arg;
+
+  acquire(&log->lock);
+  for(;;){
+    while(!log->installing)
+      sleep(&log->installing, &log->lock);
+    release(&log->lock);
+
+    install_trans(log, &log->ilh, log->logbuf[log->iset], 0); // install writes to home locations
+
+    acquire(&log->lock);
+    log->installing = 0;
+    wakeup(log);
   }
-  bwrite(buf);
-  brelse(buf);
 }
 
+// Return once transaction t has committed, committing it
+// if it has no operations left. Caller holds log->lock.
 static void
-recover_from_log(void)
+waitcommit(struct log *log, int t)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  while(log->done < t){
+    if(log->outstanding == 0 && !log->committing && log->seq == t){
+      // call commit w/o holding locks, since not allowed
+      // to sleep with locks.
+      log->closing = 1;
+      log->committing = 1;
+      release(&log->lock);
+      commit(log, t);
+      acquire(&log->lock);
+    } else {
+      sleep(log, &log->lock);
+    }
+  }
 }
 
-// called at the start of each FS system call.
+// The logtimer kernel thread: with a commit interval set,
+// commit the open transaction once it is that old.
+static void
+logtimer(void *arg)
+{
+  struct log *log = arg;
+
+  acquire(&log->lock);
+  for(;;){
+    if(log->interval == 0 || log->lh.n == 0)
+      sleep(&log->opened, &log->lock);
+    else if(ticks - log->opened < log->interval)
+      sleep(&ticks, &log->lock);
+    else
+      waitcommit(log, log->seq);
+  }
+}
+
+// Set the commit interval of every log to n ticks, unless n
+// is -1. Returns the old interval.
+int
+log_interval(int n)
+{
+  struct log *log;
+  int old;
+
+  if(n < -1)
+    return -1;
+  old = logs[0].interval;
+  if(n < 0)
+    return old;
+  for(log = logs; log < logs + NDISK; log++){
+    acquire(&log->lock);
+    log->interval = n;
+    if(n == 0)
+      waitcommit(log, log->seq);  // back to committing every op
+    release(&log->lock);
+  }
+  return old;
+}
+
+// The open transaction of dev's log, which an operation in
+// progress belongs to.
+int
+log_seq(uint dev)
+{
+  struct log *log = devlog(dev);
+  int t;
+
+  acquire(&log->lock);
+  t = log->seq;
+  release(&log->lock);
+  return t;
+}
+
+// Return once transaction t of dev's log, and so every
+// operation that joined it, has committed.
+void
+log_force(uint dev, int t)
+{
+  struct log *log = devlog(dev);
+
+  acquire(&log->lock);
+  waitcommit(log, t);
+  release(&log->lock);
+}
+
+// report log counters, summed over the logs.
 void
-begin_op(void)
+log_stats(struct kstat *st)
+{
+  struct log *log;
+
+  st->commits = 0;
+  for(log = logs; log < logs + NDISK; log++){
+    acquire(&log->lock);
+    st->commits += log->ncommit;
+    release(&log->lock);
+  }
+}
+
+// the most blocks one operation can reserve.
+int
+log_opmax(void)
+{
+  return logs[0].cap;
+}
+
+// Could an op of n blocks overflow log's open transaction?
+static int
+short_of_space(struct log *log, int n)
 {
-  acquire(&log.lock);
+  return log->lh.n + log->reserved + n > log->cap;
+}
+
+// called at the start of an FS system call that writes at
+// most n blocks, all of them on device dev. joins the open
+// transaction of dev's log, if it has one.
+void
+begin_opn(uint dev, int n)
+{
+  struct proc *p = myproc();
+  struct log *log;
+
+  if((log = findlog(dev)) == 0)
+    return;
+  if(p->oplog)
+    panic("begin_op: nested");
+  if(n > log->cap)
+    panic("begin_opn");
+  acquire(&log->lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    if(log->closing){
+      sleep(log, &log->lock);
+    } else if(short_of_space(log, n)){
       // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      if(log->interval)
+        waitcommit(log, log->seq);  // no end_op() is going to
+      else
+        sleep(log, &log->lock);
     } else {
-      log.outstanding += 1;
-      release(&log.lock);
+      log->outstanding += 1;
+      log->reserved += n;
       break;
     }
   }
+  release(&log->lock);
+  p->oplog = log - logs + 1;
+  p->opwrote = 0;
+}
+
+// called at the start of each FS system call.
+void
+begin_op(uint dev)
+{
+  begin_opn(dev, MAXOPBLOCKS);
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// returns once the transaction this operation joined has
+// committed, committing it if this was its last operation;
+// with a commit interval set, or if the operation wrote
+// nothing, returns at once.
+void
+end_op(uint dev)
+{
+  end_opn(dev, MAXOPBLOCKS);
+}
+
+// end_op() for an operation started by begin_opn(dev, n).
 void
-end_op(void)
-{
-  int do_commit = 0;
-
-  acquire(&log.lock);
-  log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
+end_opn(uint dev, int n)
+{
+  struct proc *p = myproc();
+  struct log *log;
+
+  if((log = findlog(dev)) != 0){
+    if(p->oplog != log - logs + 1)
+      panic("end_op");
+    acquire(&log->lock);
+    if(log->closing)
+      panic("log->closing");
+    log->outstanding -= 1;
+    log->reserved -= n;
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log->outstanding has decreased
     // the amount of reserved space.
-    wakeup(&log);
+    wakeup(log);
+    if(p->opwrote && log->interval == 0)
+      waitcommit(log, log->seq);  // ops only ever join the open transaction
+    release(&log->lock);
+    p->oplog = 0;
   }
-  release(&log.lock);
+  if(p->iputq)
+    iputdeferred();
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
-  }
+// Has the current FS call joined the log of dev, so that it
+// can write there? True of a device with no log (tmpfs).
+int
+log_joined(uint dev)
+{
+  struct log *log = findlog(dev);
+
+  return log == 0 || myproc()->oplog == log - logs + 1;
+}
+
+// Is the current process in an FS call's transaction?
+int
+log_inop(void)
+{
+  return myproc()->oplog != 0;
 }
 
-// Copy modified blocks from cache to log.
+// Write the closed transaction, whose blocks are already
+// copied into bufs[], and its header to the next log slot,
+// all in one batch. The transaction has committed once
+// write_log() returns.
 static void
-write_log(void)
+write_log(struct log *log, struct logheader *lh, struct buf **bufs)
 {
+  uint base = log->start + log->slot * SLOTSIZE(log);
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < lh->n; tail++) {
+    bufs[tail]->dev = log->ldev;
+    bufs[tail]->blockno = base + tail + 1;
+    bsubmit(bufs[tail], 1);  // write the log
   }
+  memset(log->loghead.data, 0, BSIZE);
+  *(struct logheader *) (log->loghead.data) = *lh;
+  log->loghead.dev = log->ldev;
+  log->loghead.blockno = base;
+  bsubmit(&log->loghead, 1);  // and the header
+  bkick();
+  for (tail = 0; tail < lh->n; tail++)
+    bwait(bufs[tail]);
+  bwait(&log->loghead);
+  log->slot = 1 - log->slot;
 }
 
+// Close open transaction t, which has no operations left,
+// and commit it.
 static void
-commit()
+commit(struct log *log, int t)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int tail, set;
+
+  // copy the blocks out of the cache, into the set of
+  // log->logbuf[] logflush isn't using. no operations are
+  // running, and none can start, so the copies are
+  // consistent.
+  set = 1 - log->iset;
+  for (tail = 0; tail < log->lh.n; tail++) {
+    struct buf *from = bread(log->dev, log->lh.block[tail]); // cache block
+    memmove(log->logbuf[set][tail]->data, from->data, BSIZE);
+    brelse(from);
+  }
+
+  // open the next transaction.
+  acquire(&log->lock);
+  log->clh = log->lh;
+  log->lh.n = 0;
+  hashclear(log);
+  log->seq += 1;
+  log->closing = 0;
+  wakeup(log);
+
+  if (log->clh.n > 0) {
+    // the slot to be written held the transaction before
+    // the one being installed, so it is free once that
+    // one has been installed too.
+    while(log->installing)
+      sleep(log, &log->lock);
+    release(&log->lock);
+
+    log->clh.seq = t;
+    log->clh.cksum = trans_cksum(&log->clh, log->logbuf[set]);
+    write_log(log, &log->clh, log->logbuf[set]); // the real commit
+
+    // hand the transaction to logflush.
+    acquire(&log->lock);
+    log->ncommit++;
+    log->ilh = log->clh;
+    log->iset = set;
+    log->installing = 1;
+    wakeup(&log->installing);
   }
+  log->committing = 0;
+  log->done = t;
+  wakeup(log);
+  release(&log->lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -214,23 +716,32 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
+  struct log *log = devlog(b->dev);
+  struct proc *p = myproc();
+  int i, h;
 
-  acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
-  if (log.outstanding < 1)
+  if (p->oplog != log - logs + 1)
     panic("log_write outside of trans");
+  p->opwrote = 1;
+  acquire(&log->lock);
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
+  h = b->blockno % LOGHASH;
+  for (i = log->hhead[h]; i >= 0; i = log->hnext[i]) {
+    if (log->lh.block[i] == b->blockno)   // log absorption
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  if (i < 0) {  // Add new block to log?
+    if (log->lh.n >= log->cap)
+      panic("too big a transaction");
+    i = log->lh.n++;
+    if(i == 0){
+      log->opened = ticks;
+      wakeup(&log->opened);
+    }
+    log->lh.block[i] = b->blockno;
+    log->hnext[i] = log->hhead[h];
+    log->hhead[h] = i;
     bpin(b);
-    log.lh.n++;
   }
-  release(&log.lock);
+  release(&log->lock);
 }
-
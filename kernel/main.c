@@ -25,9 +25,14 @@ main()
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    ioschedinit();   // disk request queue
     iinit();         // inode table
+    dcacheinit();    // directory entry cache
+    tmpfsinit();     // in-memory file system
     fileinit();      // file table
+    epollinit();     // epoll instances
     virtio_disk_init(); // emulated hard disk
+    ramdiskinit();   // root file system in RAM, with RAMROOT
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
@@ -21,14 +21,17 @@
 #define UART0 0x10000000L
 #define UART0_IRQ 10
 
-// virtio mmio interface
+// virtio mmio interface; disk i is at VIRTIO0 + i*0x1000,
+// interrupting on VIRTIO0_IRQ + i.
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
+#define VIRTIO1 0x10002000
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define TIMEFREQ 10000000 // mtime (and the time CSR) ticks per second
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -45,7 +48,17 @@
 // for use by the kernel and user pages
 // from physical address 0x80000000 to PHYSTOP.
 #define KERNBASE 0x80000000L
+
+// with RAMROOT, the root file system is a ramdisk in the top
+// RAMDISKSZ bytes of RAM, which qemu's loader device fills
+// from fs.img; the kernel leaves them out of PHYSTOP.
+#define RAMDISKSZ (4*1024*1024)
+#define RAMDISK (KERNBASE + 128*1024*1024 - RAMDISKSZ)
+#ifdef RAMROOT
+#define PHYSTOP RAMDISK
+#else
 #define PHYSTOP (KERNBASE + 128*1024*1024)
+#endif
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
@@ -1,13 +1,32 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE      256  // open files per process
+#define NFILE      2048  // open files per system
+#define NINODE      500  // maximum number of in-memory i-nodes
 #define NDEV         10  // maximum major device number
-#define ROOTDEV       1  // device number of file system root disk
+#define DISKDEV       1  // virtio disks: devices DISKDEV..DISKDEV+NDISK-1
+#define NDISK         2  // virtio disks, and most disk file systems in use
+#define RAMDEV        (DISKDEV+NDISK)  // the ramdisk (RAMROOT)
+#define NBDEV         (RAMDEV+1)  // block device numbers
+#ifdef RAMROOT
+#define ROOTDEV       RAMDEV  // device number of file system root disk
+#else
+#define ROOTDEV       DISKDEV
+#endif
+#define TMPDEV      100  // device number of tmpfs
+#define NMOUNT        4  // mounted file systems
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
+#define LOGSIZE      126  // max data blocks in a log slot (mkfs)
+#define NDELAY       64  // max blocks awaiting allocation per inode (< LOGSIZE)
+#define NDELAYBUF   128  // max blocks awaiting allocation in the cache
+#define NBUF         (LOGSIZE*3*NDISK+MAXOPBLOCKS+NDELAYBUF)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define IOSCHED      IOSCHED_DEADLINE  // default I/O scheduler (sysctl.h)
+#ifndef DISKPOLL
+#define DISKPOLL     0   // poll for disk completions; make DISKPOLL=1
+#endif
+#define MAXREADAHEAD 16  // largest readahead window, in blocks
+#define NEPOLL       16  // epoll instances per system
+#define NEPITEM    1024  // epoll items per system
@@ -7,6 +7,7 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "epoll.h"
 
 #define PIPESIZE 512
 
@@ -17,6 +18,7 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct epitem *watch;  // epoll items watching either end
 };
 
 int
@@ -34,6 +36,7 @@ pipealloc(struct file **f0, struct file **f1)
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->watch = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -62,9 +65,11 @@ pipeclose(struct pipe *pi, int writable)
   if(writable){
     pi->writeopen = 0;
     wakeup(&pi->nread);
+    epoll_notify(pi->watch, EPOLLIN|EPOLLHUP);
   } else {
     pi->readopen = 0;
     wakeup(&pi->nwrite);
+    epoll_notify(pi->watch, EPOLLOUT|EPOLLERR);
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
@@ -87,6 +92,7 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
       wakeup(&pi->nread);
+      epoll_notify(pi->watch, EPOLLIN);
       sleep(&pi->nwrite, &pi->lock);
     } else {
       char ch;
@@ -97,6 +103,8 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
     }
   }
   wakeup(&pi->nread);
+  if(i > 0)
+    epoll_notify(pi->watch, EPOLLIN);
   release(&pi->lock);
 
   return i;
@@ -125,6 +133,33 @@ piperead(struct pipe *pi, uint64 addr, int n)
       break;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(i > 0)
+    epoll_notify(pi->watch, EPOLLOUT);
   release(&pi->lock);
   return i;
 }
+
+// Add (add=1) or remove (add=0) an epoll item on pi's watch list.
+// Returns the events currently pending on the pipe; epoll
+// masks off the ones that don't apply to the item's end.
+int
+pipewatch(struct pipe *pi, struct epitem *it, int add)
+{
+  int ev = 0;
+
+  acquire(&pi->lock);
+  if(add)
+    epoll_link(&pi->watch, it);
+  else
+    epoll_unlink(&pi->watch, it);
+  if(pi->nread != pi->nwrite)
+    ev |= EPOLLIN;
+  if(pi->nwrite != pi->nread + PIPESIZE)
+    ev |= EPOLLOUT;
+  if(pi->writeopen == 0)
+    ev |= EPOLLIN|EPOLLHUP;
+  if(pi->readopen == 0)
+    ev |= EPOLLOUT|EPOLLERR;
+  release(&pi->lock);
+  return ev;
+}
@@ -168,6 +168,7 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
   p->state = UNUSED;
 }
 
@@ -254,6 +255,35 @@ userinit(void)
   release(&p->lock);
 }
 
+// A kernel thread's first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+  myproc()->kfn(myproc()->karg);
+  panic("kthread returned");
+}
+
+// Start a kernel thread running fn(arg), which must never
+// return. It has a proc slot, so it can sleep, but no user
+// memory.
+void
+kthread(void (*fn)(void*), void *arg, char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->karg = arg;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -360,9 +390,9 @@ exit(int status)
     }
   }
 
-  begin_op();
+  // outside a transaction: iput() begins one on the cwd's
+  // device if it must free it.
   iput(p->cwd);
-  end_op();
   p->cwd = 0;
 
   acquire(&wait_lock);
@@ -524,7 +554,9 @@ forkret(void)
     // regular process (e.g., because it calls sleep), and thus cannot
     // be run from main().
     first = 0;
-    fsinit(ROOTDEV);
+    loginit();
+    if(fsinit(ROOTDEV) < 0)
+      panic("invalid file system");
   }
 
   usertrapret();
@@ -104,4 +104,9 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int oplog;                   // 1 + logs[] index its FS call joined, or 0
+  int opwrote;                 // has that FS call written to the log?
+  struct inode *iputq;         // inodes to free after the FS call (see iput())
+  void (*kfn)(void*);          // Kernel thread's function, or 0
+  void *karg;                  // and its argument
 };
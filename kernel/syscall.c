@@ -102,6 +102,21 @@ extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_lock(void);
+extern uint64 sys_epoll_create(void);
+extern uint64 sys_epoll_ctl(void);
+extern uint64 sys_epoll_wait(void);
+extern uint64 sys_kstat(void);
+extern uint64 sys_sysctl(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_ftruncate(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_mount(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -127,7 +142,22 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
-[SYS_lock]    sys_lock
+[SYS_lock]    sys_lock,
+[SYS_epoll_create] sys_epoll_create,
+[SYS_epoll_ctl]    sys_epoll_ctl,
+[SYS_epoll_wait]   sys_epoll_wait,
+[SYS_kstat]        sys_kstat,
+[SYS_sysctl]       sys_sysctl,
+[SYS_pread]        sys_pread,
+[SYS_pwrite]       sys_pwrite,
+[SYS_readv]        sys_readv,
+[SYS_writev]       sys_writev,
+[SYS_lseek]        sys_lseek,
+[SYS_ftruncate]    sys_ftruncate,
+[SYS_fallocate]    sys_fallocate,
+[SYS_fsync]        sys_fsync,
+[SYS_fdatasync]    sys_fdatasync,
+[SYS_mount]        sys_mount,
 };
 
 void
@@ -20,4 +20,19 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
-#define SYS_lock   22
\ No newline at end of file
+#define SYS_lock   22
+#define SYS_epoll_create 23
+#define SYS_epoll_ctl    24
+#define SYS_epoll_wait   25
+#define SYS_kstat        26
+#define SYS_sysctl       27
+#define SYS_pread        28
+#define SYS_pwrite       29
+#define SYS_readv        30
+#define SYS_writev       31
+#define SYS_lseek        32
+#define SYS_ftruncate    33
+#define SYS_fallocate    34
+#define SYS_fsync        35
+#define SYS_fdatasync    36
+#define SYS_mount        37
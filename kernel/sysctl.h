@@ -0,0 +1,10 @@
+// Kernel tunables, read and set with sysctl().
+// Both the kernel and user programs use this header file.
+
+#define CTL_IOSCHED  1   // I/O scheduler policy
+#define CTL_DISKPOLL 2   // 1 to poll for disk completions, 0 to sleep
+#define CTL_COMMIT   3   // ticks between log commits; 0 commits each op
+
+// CTL_IOSCHED values
+#define IOSCHED_NOOP      0
+#define IOSCHED_DEADLINE  1
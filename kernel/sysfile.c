@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "epoll.h"
+#include "iovec.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -94,6 +96,153 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// pread(fd, buf, n, off): read at off, leaving the file's
+// offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+// Fetch the iovec array that is argument n, with its
+// length in argument n+1.
+static int
+argiov(int n, struct iovec *iov, int *cnt)
+{
+  uint64 addr, total;
+  int i;
+
+  argaddr(n, &addr);
+  argint(n + 1, cnt);
+  if(*cnt < 0 || *cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, *cnt * sizeof(*iov)) < 0)
+    return -1;
+  // the count of bytes moved must fit in the return value.
+  total = 0;
+  for(i = 0; i < *cnt; i++){
+    if(iov[i].iov_len > 0x7fffffff)
+      return -1;
+    total += iov[i].iov_len;
+  }
+  if(total > 0x7fffffff)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, &cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(1, iov, &cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
+// lseek(fd, off, whence): returns the new offset.
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+uint64
+sys_ftruncate(void)
+{
+  struct file *f;
+  int len;
+
+  argint(1, &len);
+  if(argfd(0, 0, &f) < 0 || len < 0)
+    return -1;
+  return filetruncate(f, len);
+}
+
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+// an i-node has no times to leave out, so
+// fdatasync() has no less to do than fsync().
+uint64
+sys_fdatasync(void)
+{
+  return sys_fsync();
+}
+
+// fallocate(fd, mode, off, len)
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int mode, off, len;
+
+  argint(1, &mode);
+  argint(2, &off);
+  argint(3, &len);
+  if(argfd(0, 0, &f) < 0 || off < 0 || len <= 0)
+    return -1;
+  return filefallocate(f, mode, off, len);
+}
+
 uint64
 sys_close(void)
 {
@@ -125,20 +274,30 @@ sys_link(void)
 {
   char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
+  uint dev;
 
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
-  if((ip = namei(old)) == 0){
-    end_op();
+  if((ip = namei(old)) == 0)
+    return -1;
+  if((dp = nameiparent(new, name)) == 0){
+    iput(ip);
     return -1;
   }
+  if(dp->dev != ip->dev){
+    iput(dp);
+    iput(ip);
+    return -1;
+  }
+  dev = ip->dev;
 
+  begin_op(dev);
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
-    end_op();
+    iput(dp);
+    end_op(dev);
     return -1;
   }
 
@@ -146,17 +305,15 @@ sys_link(void)
   iupdate(ip);
   iunlock(ip);
 
-  if((dp = nameiparent(new, name)) == 0)
-    goto bad;
   ilock(dp);
-  if(dp->dev != ip->dev || dirlink(dp, name, ip->inum) < 0){
+  if(dirlink(dp, name, ip->inum) < 0){
     iunlockput(dp);
     goto bad;
   }
   iunlockput(dp);
   iput(ip);
 
-  end_op();
+  end_op(dev);
 
   return 0;
 
@@ -165,7 +322,7 @@ bad:
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
-  end_op();
+  end_op(dev);
   return -1;
 }
 
@@ -191,17 +348,16 @@ sys_unlink(void)
   struct inode *ip, *dp;
   struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
-  uint off;
+  uint off, dev;
 
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
-  if((dp = nameiparent(path, name)) == 0){
-    end_op();
+  if((dp = nameiparent(path, name)) == 0)
     return -1;
-  }
+  dev = dp->dev;
 
+  begin_op(dev);
   ilock(dp);
 
   // Cannot unlink "." or "..".
@@ -214,7 +370,7 @@ sys_unlink(void)
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
+  if(ip->type == T_DIR && (!isdirempty(ip) || ismount(ip))){
     iunlockput(ip);
     goto bad;
   }
@@ -222,6 +378,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_enter(dp, name, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -232,24 +389,23 @@ sys_unlink(void)
   iupdate(ip);
   iunlockput(ip);
 
-  end_op();
+  end_op(dev);
 
   return 0;
 
 bad:
   iunlockput(dp);
-  end_op();
+  end_op(dev);
   return -1;
 }
 
+// Create name in directory dp, or for a plain file, find
+// it there, and return it locked. Consumes the reference to
+// dp. Must be called inside a transaction on dp's device.
 static struct inode*
-create(char *path, short type, short major, short minor)
+create(struct inode *dp, char *name, short type, short major, short minor)
 {
-  struct inode *ip, *dp;
-  char name[DIRSIZ];
-
-  if((dp = nameiparent(path, name)) == 0)
-    return 0;
+  struct inode *ip;
 
   ilock(dp);
 
@@ -306,38 +462,43 @@ sys_open(void)
 {
   char path[MAXPATH];
   int fd, omode;
+  char name[DIRSIZ];
   struct file *f;
-  struct inode *ip;
+  struct inode *ip, *dp;
   int n;
+  uint dev;
 
   argint(1, &omode);
   if((n = argstr(0, path, MAXPATH)) < 0)
     return -1;
 
-  begin_op();
-
+  // find the device first: the call joins only its log.
   if(omode & O_CREATE){
-    ip = create(path, T_FILE, 0, 0);
+    if((dp = nameiparent(path, name)) == 0)
+      return -1;
+    dev = dp->dev;
+    begin_op(dev);
+    ip = create(dp, name, T_FILE, 0, 0);
     if(ip == 0){
-      end_op();
+      end_op(dev);
       return -1;
     }
   } else {
-    if((ip = namei(path)) == 0){
-      end_op();
+    if((ip = namei(path)) == 0)
       return -1;
-    }
+    dev = ip->dev;
+    begin_op(dev);
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
-      end_op();
+      end_op(dev);
       return -1;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
-    end_op();
+    end_op(dev);
     return -1;
   }
 
@@ -345,7 +506,7 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
-    end_op();
+    end_op(dev);
     return -1;
   }
 
@@ -355,6 +516,9 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->raoff = 0;
+    f->rablock = 0;
+    f->rawin = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -365,7 +529,7 @@ sys_open(void)
   }
 
   iunlock(ip);
-  end_op();
+  end_op(dev);
 
   return fd;
 }
@@ -373,36 +537,62 @@ sys_open(void)
 uint64
 sys_mkdir(void)
 {
-  char path[MAXPATH];
-  struct inode *ip;
+  char name[DIRSIZ], path[MAXPATH];
+  struct inode *ip, *dp;
+  uint dev;
 
-  begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
-    end_op();
+  if(argstr(0, path, MAXPATH) < 0 || (dp = nameiparent(path, name)) == 0)
+    return -1;
+  dev = dp->dev;
+  begin_op(dev);
+  if((ip = create(dp, name, T_DIR, 0, 0)) == 0){
+    end_op(dev);
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  end_op(dev);
   return 0;
 }
 
 uint64
 sys_mknod(void)
 {
-  struct inode *ip;
-  char path[MAXPATH];
+  struct inode *ip, *dp;
+  char name[DIRSIZ], path[MAXPATH];
   int major, minor;
+  uint dev;
 
-  begin_op();
   argint(1, &major);
   argint(2, &minor);
-  if((argstr(0, path, MAXPATH)) < 0 ||
-     (ip = create(path, T_DEVICE, major, minor)) == 0){
-    end_op();
+  if((argstr(0, path, MAXPATH)) < 0 || (dp = nameiparent(path, name)) == 0)
+    return -1;
+  dev = dp->dev;
+  begin_op(dev);
+  if((ip = create(dp, name, T_DEVICE, major, minor)) == 0){
+    end_op(dev);
     return -1;
   }
   iunlockput(ip);
-  end_op();
+  end_op(dev);
+  return 0;
+}
+
+// mount(path, dev): mount the file system on dev, which
+// must be TMPDEV for now, on directory path.
+uint64
+sys_mount(void)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+  int dev;
+
+  argint(1, &dev);
+  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0)
+    return -1;
+  if(mount(ip, dev) < 0){
+    iput(ip);
+    return -1;
+  }
   return 0;
 }
 
@@ -413,20 +603,17 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
-    end_op();
+  // nothing to write: iput() frees the old cwd, if it must,
+  // in a transaction of its own.
+  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0)
     return -1;
-  }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
-    end_op();
     return -1;
   }
   iunlock(ip);
   iput(p->cwd);
-  end_op();
   p->cwd = ip;
   return 0;
 }
@@ -503,3 +690,55 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_epoll_create(void)
+{
+  struct file *f;
+  int fd;
+
+  if(epollalloc(&f) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+uint64
+sys_epoll_ctl(void)
+{
+  struct file *epf, *f;
+  struct epoll_event ev;
+  int op;
+  uint64 uev; // user pointer to struct epoll_event
+
+  argint(1, &op);
+  argaddr(3, &uev);
+  if(argfd(0, 0, &epf) < 0 || argfd(2, 0, &f) < 0)
+    return -1;
+  if(epf->type != FD_EPOLL)
+    return -1;
+  if(op != EPOLL_CTL_DEL &&
+     copyin(myproc()->pagetable, (char*)&ev, uev, sizeof(ev)) < 0)
+    return -1;
+  return epollctl(epf->ep, op, f, &ev);
+}
+
+uint64
+sys_epoll_wait(void)
+{
+  struct file *f;
+  uint64 evs; // user pointer to array of struct epoll_event
+  int maxevents, timeout;
+
+  argaddr(1, &evs);
+  argint(2, &maxevents);
+  argint(3, &timeout);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_EPOLL)
+    return -1;
+  return epollwait(f->ep, evs, maxevents, timeout);
+}
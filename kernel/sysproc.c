@@ -7,6 +7,8 @@
 #include "proc.h"
 #include "sleeplock.h"
 #include "lock_consts.h"
+#include "kstat.h"
+#include "sysctl.h"
 
 
 uint64
@@ -93,6 +95,45 @@ sys_uptime(void)
   return xticks;
 }
 
+// copy the kernel's performance counters to
+// the user struct kstat at addr.
+uint64
+sys_kstat(void)
+{
+  uint64 addr;
+  struct kstat st;
+
+  argaddr(0, &addr);
+  memset(&st, 0, sizeof(st));
+  virtio_disk_stats(&st);
+  bstats(&st);
+  log_stats(&st);
+  dcache_stats(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// read and set kernel tunables. sets tunable
+// name to val unless val is -1; returns the
+// old value, or -1 for an unknown name.
+uint64
+sys_sysctl(void)
+{
+  int name, val;
+
+  argint(0, &name);
+  argint(1, &val);
+  switch(name){
+  case CTL_IOSCHED:
+    return iosched_select(val);
+  case CTL_DISKPOLL:
+    return virtio_disk_poll(val);
+  case CTL_COMMIT:
+    return log_interval(val);
+  }
+  return -1;
+}
 
 #define n 256
 
@@ -0,0 +1,279 @@
+//
+// tmpfs: a file system kept in memory, for scratch files that
+// needn't outlive a reboot. It is device TMPDEV; init mounts
+// it on /tmp.
+//
+// Its i-nodes are the struct tnodes in tmpfs.node[], which
+// play the part of the on-disk i-nodes: the inode table
+// caches them like any others, and ilock() and iupdate() copy
+// them in and out. A file's data is in kalloc()ed pages,
+// listed in a page of pointers. Directories hold struct
+// dirents, as on disk, so dirlookup() and dirlink() work
+// unchanged. Nothing goes through the buffer cache or the log.
+// TMPDEV has no log, so begin_op(TMPDEV) joins none: calls
+// on tmpfs files and directories never wait on a disk's
+// commit. A path from a disk directory into /tmp is looked
+// up outside the call's transaction, and iput() frees any
+// disk inode it drops in one of its own.
+//
+// The tnode's fields, like a disk i-node's, are protected by
+// the lock of the in-memory inode; tmpfs.lock only guards
+// allocating them, and the count of pages in use. tmpfs
+// holds at most NTMPPAGE pages, so that filling /tmp can't
+// take all of memory from the rest of the kernel.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stat.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define NTNODE  200
+#define NTPAGE  (PGSIZE / sizeof(char*))  // data pages per file
+#define NTMPPAGE 1024  // pages all of tmpfs may hold
+
+struct tnode {
+  short type;     // 0 if free
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  char **pages;   // 0 until the file has data
+};
+
+struct {
+  struct spinlock lock;
+  struct tnode node[NTNODE];
+  int npage;      // pages allocated, at most NTMPPAGE
+} tmpfs;
+
+// Allocate a zeroed page for tmpfs, or return 0 if it
+// already holds NTMPPAGE or memory has run out.
+static char*
+tmp_palloc(void)
+{
+  char *p;
+
+  acquire(&tmpfs.lock);
+  if(tmpfs.npage >= NTMPPAGE){
+    release(&tmpfs.lock);
+    return 0;
+  }
+  tmpfs.npage++;
+  release(&tmpfs.lock);
+  if((p = kalloc()) == 0){
+    acquire(&tmpfs.lock);
+    tmpfs.npage--;
+    release(&tmpfs.lock);
+    return 0;
+  }
+  memset(p, 0, PGSIZE);
+  return p;
+}
+
+static void
+tmp_pfree(char *p)
+{
+  kfree(p);
+  acquire(&tmpfs.lock);
+  tmpfs.npage--;
+  release(&tmpfs.lock);
+}
+
+// Set up an empty root directory.
+void
+tmpfsinit(void)
+{
+  struct tnode *t = &tmpfs.node[ROOTINO];
+  struct dirent *de;
+
+  initlock(&tmpfs.lock, "tmpfs");
+  if((t->pages = (char**)tmp_palloc()) == 0)
+    panic("tmpfsinit");
+  if((t->pages[0] = tmp_palloc()) == 0)
+    panic("tmpfsinit");
+  de = (struct dirent*)t->pages[0];
+  de[0].inum = ROOTINO;
+  strncpy(de[0].name, ".", DIRSIZ);
+  de[1].inum = ROOTINO;
+  strncpy(de[1].name, "..", DIRSIZ);
+  t->type = T_DIR;
+  t->nlink = 1;
+  t->size = 2 * sizeof(*de);
+}
+
+static struct tnode*
+tnode(struct inode *ip)
+{
+  return &tmpfs.node[ip->inum];
+}
+
+// Allocate a tnode of the given type, returning its
+// unlocked but allocated and referenced inode, or 0.
+struct inode*
+tmp_ialloc(short type)
+{
+  struct tnode *t;
+  int inum;
+
+  acquire(&tmpfs.lock);
+  for(inum = 1; inum < NTNODE; inum++){
+    t = &tmpfs.node[inum];
+    if(t->type == 0){
+      memset(t, 0, sizeof(*t));
+      t->type = type;
+      release(&tmpfs.lock);
+      return iget(TMPDEV, inum);
+    }
+  }
+  release(&tmpfs.lock);
+  printf("tmp_ialloc: no inodes\n");
+  return 0;
+}
+
+// ilock() for a tmpfs inode: copy in its tnode.
+void
+tmp_iload(struct inode *ip)
+{
+  struct tnode *t = tnode(ip);
+
+  ip->type = t->type;
+  ip->major = t->major;
+  ip->minor = t->minor;
+  ip->nlink = t->nlink;
+  ip->size = t->size;
+  ip->flags = 0;
+}
+
+// iupdate() for a tmpfs inode. A type of 0 frees the tnode;
+// its pages are gone already.
+void
+tmp_iupdate(struct inode *ip)
+{
+  struct tnode *t = tnode(ip);
+
+  t->major = ip->major;
+  t->minor = ip->minor;
+  t->nlink = ip->nlink;
+  t->size = ip->size;
+  acquire(&tmpfs.lock);
+  t->type = ip->type;
+  release(&tmpfs.lock);
+}
+
+// Return page pg of ip's data, allocating it if alloc is
+// set; 0 if there is none.
+static char*
+tmp_page(struct inode *ip, uint pg, int alloc)
+{
+  struct tnode *t = tnode(ip);
+
+  if(pg >= NTPAGE)
+    return 0;
+  if(t->pages == 0){
+    if(!alloc || (t->pages = (char**)tmp_palloc()) == 0)
+      return 0;
+  }
+  if(t->pages[pg] == 0 && alloc){
+    if((t->pages[pg] = tmp_palloc()) == 0)
+      return 0;
+  }
+  return t->pages[pg];
+}
+
+// itruncate() for a tmpfs inode: free the pages wholly past
+// size and zero the rest of the last one.
+int
+tmp_itruncate(struct inode *ip, uint size)
+{
+  struct tnode *t = tnode(ip);
+  uint pg, keep;
+
+  if(size > NTPAGE * PGSIZE)
+    return -1;
+  if(t->pages){
+    keep = (size + PGSIZE - 1) / PGSIZE;
+    for(pg = keep; pg < NTPAGE; pg++){
+      if(t->pages[pg]){
+        tmp_pfree(t->pages[pg]);
+        t->pages[pg] = 0;
+      }
+    }
+    if(size % PGSIZE && t->pages[keep - 1])
+      memset(t->pages[keep - 1] + size % PGSIZE, 0, PGSIZE - size % PGSIZE);
+    if(size == 0){
+      tmp_pfree((char*)t->pages);
+      t->pages = 0;
+    }
+  }
+  ip->size = size;
+  tmp_iupdate(ip);
+  return 0;
+}
+
+// iprealloc() for a tmpfs inode: allocate the pages
+// holding bytes off..off+n-1.
+int
+tmp_iprealloc(struct inode *ip, uint off, uint n)
+{
+  uint pg;
+
+  for(pg = off / PGSIZE; pg <= (off + n - 1) / PGSIZE; pg++)
+    if(tmp_page(ip, pg, 1) == 0)
+      return -1;
+  return 0;
+}
+
+// readi() for a tmpfs inode. Missing pages read as zeros.
+int
+tmp_readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  static char zeroes[PGSIZE];
+  uint tot, m;
+  char *p;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot = 0; tot < n; tot += m, off += m, dst += m){
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    if((p = tmp_page(ip, off / PGSIZE, 0)) == 0)
+      p = zeroes;
+    if(either_copyout(user_dst, dst, p + off % PGSIZE, m) == -1)
+      return -1;
+  }
+  return tot;
+}
+
+// writei() for a tmpfs inode.
+int
+tmp_writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m;
+  char *p;
+
+  if(off + n < off || off + n > NTPAGE * PGSIZE)
+    return -1;
+
+  for(tot = 0; tot < n; tot += m, off += m, src += m){
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    if((p = tmp_page(ip, off / PGSIZE, 1)) == 0)
+      break;
+    if(either_copyin(p + off % PGSIZE, user_src, src, m) == -1)
+      break;
+  }
+  if(off > ip->size){
+    ip->size = off;
+    tmp_iupdate(ip);
+  }
+  return tot;
+}
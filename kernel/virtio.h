@@ -47,7 +47,18 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 128
+
+// at most this many blocks in one request.
+#define MAXSEG 32
+
+// at most this many requests outstanding at the device; the
+// rest wait in the I/O scheduler, where they can be sorted.
+#define QDEPTH 4
+
+// in polled mode, a waiter spins this long for its request to
+// finish before going to sleep for the interrupt.
+#define POLLUS 200 // microseconds
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -61,11 +72,12 @@ struct virtq_desc {
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
-  uint16 flags; // always zero
+  uint16 flags; // without EVENT_IDX: NO_INTERRUPT to poll instead
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // with EVENT_IDX: interrupt when used idx passes this
 };
+#define VRING_AVAIL_F_NO_INTERRUPT 1 // don't interrupt (without EVENT_IDX)
 
 // one entry in the "used" ring, with which the
 // device tells the driver about completed requests.
@@ -78,6 +90,8 @@ struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // with EVENT_IDX: device wants a notify when avail idx passes this;
+                      // not read, dispatch() notifies once per batch instead
 };
 
 // these are specific to virtio block devices, e.g. disks,
@@ -4,6 +4,11 @@
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
+// there may be up to NDISK disks, on consecutive mmio buses
+// from VIRTIO0; disk i is device DISKDEV+i. each has its own
+// queue, lock, and requests in the I/O scheduler, so requests
+// to different disks proceed in parallel.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -15,11 +20,15 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "kstat.h"
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+// the address of disk d's virtio mmio register r.
+#define R(d, r) ((volatile uint32 *)((d)->base + (r)))
 
 static struct disk {
+  uint64 base;     // mmio registers
+  uint dev;        // device number; 0 if there is no such disk
+
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
@@ -41,12 +50,27 @@ static struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  int nfree;       // number of free descriptors.
+  int queued;      // requests made available since the last notify.
+  int inflight;    // requests the device has not finished.
+
+  // polled completion: a waiter spins on used->idx for up to
+  // POLLUS before sleeping, with device interrupts suppressed
+  // while anyone is spinning.
+  int poll;        // waiters should poll?
+  int polling;     // number of waiters spinning right now.
+  int eventidx;    // negotiated VIRTIO_RING_F_EVENT_IDX?
+
+  uint64 nreq;     // requests issued to the device
+  uint64 nblk;     // blocks transferred by those requests
+  uint64 npolled;  // waits that ended while polling
+  uint64 lat[NLATBUCKET]; // wait latency histogram; see kstat.h
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b;   // first of the request's bufs, linked by qnext
     char status;
   } info[NUM];
 
@@ -56,109 +80,147 @@ static struct disk {
   
   struct spinlock vdisk_lock;
   
-} disk;
+} disks[NDISK];
 
-void
-virtio_disk_init(void)
+// set up disk d, whose registers are at base, as device dev.
+// returns -1 if there is no disk there.
+static int
+diskinit(struct disk *d, uint64 base, uint dev)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+  initlock(&d->vdisk_lock, "virtio_disk");
+  d->base = base;
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 2 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
+  if(*R(d, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(d, VIRTIO_MMIO_VERSION) != 2 ||
+     *R(d, VIRTIO_MMIO_DEVICE_ID) != 2 ||
+     *R(d, VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    return -1;
   }
   
   // reset device
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set ACKNOWLEDGE status bit
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set DRIVER status bit
   status |= VIRTIO_CONFIG_S_DRIVER;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 features = *R(d, VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  *R(d, VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  d->eventidx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // re-read status to ensure FEATURES_OK is set.
-  status = *R(VIRTIO_MMIO_STATUS);
+  status = *R(d, VIRTIO_MMIO_STATUS);
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
   // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
+  *R(d, VIRTIO_MMIO_QUEUE_SEL) = 0;
 
   // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
+  if(*R(d, VIRTIO_MMIO_QUEUE_READY))
     panic("virtio disk should not be ready");
 
   // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  uint32 max = *R(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
   if(max < NUM)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
+  d->desc = kalloc();
+  d->avail = kalloc();
+  d->used = kalloc();
+  if(!d->desc || !d->avail || !d->used)
     panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
+  memset(d->desc, 0, PGSIZE);
+  memset(d->avail, 0, PGSIZE);
+  memset(d->used, 0, PGSIZE);
 
   // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(d, VIRTIO_MMIO_QUEUE_NUM) = NUM;
 
   // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)d->desc;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)d->desc >> 32;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)d->avail;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)d->avail >> 32;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)d->used;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)d->used >> 32;
 
   // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+  *R(d, VIRTIO_MMIO_QUEUE_READY) = 0x1;
 
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+    d->free[i] = 1;
+  d->nfree = NUM;
+
+  // with EVENT_IDX, interrupt at the first completion.
+  d->avail->used_event = 0;
+  d->poll = DISKPOLL;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
+
+  d->dev = dev;
+  return 0;
+}
+
+void
+virtio_disk_init(void)
+{
+  for(int i = 0; i < NDISK; i++){
+    uint64 base = VIRTIO0 + i * (VIRTIO1 - VIRTIO0);
+    if(diskinit(&disks[i], base, DISKDEV + i) < 0){
+      if(DISKDEV + i == ROOTDEV)
+        panic("could not find virtio disk");
+      continue;
+    }
+    bdevsw[DISKDEV + i].submit = iosched_add;
+    bdevsw[DISKDEV + i].kick = virtio_disk_kick;
+    bdevsw[DISKDEV + i].wait = virtio_disk_wait;
+  }
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ
+  // and the IRQs after it.
+}
+
+// the disk that is device dev.
+static struct disk*
+devdisk(uint dev)
+{
+  if(dev < DISKDEV || dev >= DISKDEV + NDISK || disks[dev - DISKDEV].dev == 0)
+    panic("virtio: no such disk");
+  return &disks[dev - DISKDEV];
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct disk *d)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(d->free[i]){
+      d->free[i] = 0;
+      d->nfree--;
       return i;
     }
   }
@@ -167,28 +229,28 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct disk *d, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(d->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  d->desc[i].addr = 0;
+  d->desc[i].len = 0;
+  d->desc[i].flags = 0;
+  d->desc[i].next = 0;
+  d->free[i] = 1;
+  d->nfree++;
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct disk *d, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = d->desc[i].flags;
+    int nxt = d->desc[i].next;
+    free_desc(d, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -196,132 +258,315 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(struct disk *d, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(d);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(d, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// tell the device about requests added to the avail ring.
+// caller holds vdisk_lock.
+static void
+notify(struct disk *d)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  if(d->queued == 0)
+    return;
+  __sync_synchronize();
+  *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  d->queued = 0;
+}
 
-  acquire(&disk.vdisk_lock);
+// move requests from the I/O scheduler into the avail ring,
+// while there is room, and notify the device.
+// called with vdisk_lock held, from both process context and
+// the completion interrupt, so it never sleeps: what doesn't
+// fit stays queued in the scheduler until a request finishes.
+static void
+dispatch(struct disk *d)
+{
+  int idx[MAXSEG+2];
+  struct buf *b, *first;
+  int i, n;
+
+  while(d->inflight < QDEPTH && d->nfree >= 3){
+    n = d->nfree - 2;
+    if(n > MAXSEG)
+      n = MAXSEG;
+    if((first = iosched_next(d->dev, n)) == 0)
+      break;
+    for(n = 0, b = first; b; b = b->qnext)
+      n++;
 
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+    // the spec's Section 5.2 says that block operations use
+    // one descriptor for type/reserved/sector, then the data,
+    // then one for a 1-byte status result. the data may be
+    // split over several descriptors, which lets one request
+    // carry a run of adjacent blocks.
+    if(allocn_desc(d, idx, n+2) != 0)
+      panic("virtio dispatch");
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
+    // format the descriptors.
+    // qemu's virtio-blk.c reads them.
 
-  // format the three descriptors.
-  // qemu's virtio-blk.c reads them.
-
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
-
-  if(write)
-    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
-  else
-    buf0->type = VIRTIO_BLK_T_IN; // read the disk
-  buf0->reserved = 0;
-  buf0->sector = sector;
-
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
-
-  // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+    struct virtio_blk_req *buf0 = &d->ops[idx[0]];
 
-  __sync_synchronize();
+    if(first->write)
+      buf0->type = VIRTIO_BLK_T_OUT; // write the disk
+    else
+      buf0->type = VIRTIO_BLK_T_IN; // read the disk
+    buf0->reserved = 0;
+    buf0->sector = first->blockno * (BSIZE / 512);
+
+    d->desc[idx[0]].addr = (uint64) buf0;
+    d->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+    d->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+    d->desc[idx[0]].next = idx[1];
+
+    for(b = first, i = 1; b; b = b->qnext, i++){
+      b->stime = r_time();
+      d->desc[idx[i]].addr = (uint64) b->data;
+      d->desc[idx[i]].len = BSIZE;
+      if(first->write)
+        d->desc[idx[i]].flags = 0; // device reads b->data
+      else
+        d->desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+      d->desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+      d->desc[idx[i]].next = idx[i+1];
+    }
 
-  // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+    d->info[idx[0]].status = 0xff; // device writes 0 on success
+    d->desc[idx[n+1]].addr = (uint64) &d->info[idx[0]].status;
+    d->desc[idx[n+1]].len = 1;
+    d->desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+    d->desc[idx[n+1]].next = 0;
 
-  __sync_synchronize();
+    // record the run of bufs for virtio_disk_intr().
+    d->info[idx[0]].b = first;
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+    // tell the device the first index in our chain of descriptors.
+    d->avail->ring[d->avail->idx % NUM] = idx[0];
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
-  }
+    __sync_synchronize();
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+    // tell the device another avail ring entry is available.
+    d->avail->idx += 1; // not % NUM ...
+    d->queued += 1;
+    d->inflight += 1;
 
-  release(&disk.vdisk_lock);
+    d->nreq += 1;
+    d->nblk += n;
+  }
+  notify(d);
 }
 
+// start dev's requests queued in the I/O scheduler.
 void
-virtio_disk_intr()
+virtio_disk_kick(uint dev)
 {
-  acquire(&disk.vdisk_lock);
+  struct disk *d = devdisk(dev);
 
-  // the device won't raise another interrupt until we tell it
-  // we've seen this interrupt, which the following line does.
-  // this may race with the device writing new entries to
-  // the "used" ring, in which case we may process the new
-  // completion entries in this interrupt, and have nothing to do
-  // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  acquire(&d->vdisk_lock);
+  dispatch(d);
+  release(&d->vdisk_lock);
+}
 
+// ask the device not to interrupt (on=0), or to interrupt
+// again at the next completion (on=1).
+// caller holds vdisk_lock.
+static void
+intr_enable(struct disk *d, int on)
+{
+  if(d->eventidx){
+    // the device interrupts when used->idx moves past
+    // used_event; one behind what we have seen is a
+    // point it has already passed.
+    d->avail->used_event = on ? d->used_idx : d->used_idx - 1;
+  } else {
+    d->avail->flags = on ? 0 : VRING_AVAIL_F_NO_INTERRUPT;
+  }
   __sync_synchronize();
+}
 
-  // the device increments disk.used->idx when it
+// finish the requests the device has put in the used ring,
+// and start more from the I/O scheduler.
+// caller holds vdisk_lock.
+static void
+reap(struct disk *d)
+{
+  __sync_synchronize();
+
+  // the device increments d->used->idx when it
   // adds an entry to the used ring.
 
-  while(disk.used_idx != disk.used->idx){
+again:
+  while(d->used_idx != d->used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = d->used->ring[d->used_idx % NUM].id;
 
-    if(disk.info[id].status != 0)
+    if(d->info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    struct buf *b, *nb;
+    for(b = d->info[id].b; b; b = nb){
+      nb = b->qnext;
+      b->qnext = 0;
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+    }
+
+    d->info[id].b = 0;
+    free_chain(d, id);
+    d->inflight -= 1;
+
+    d->used_idx += 1;
+  }
+  if(d->polling == 0){
+    intr_enable(d, 1);
+    // with EVENT_IDX, a completion the device posted before
+    // it saw the new used_event raises no interrupt; look
+    // again now that it has.
+    if(*(volatile uint16 *)&d->used->idx != d->used_idx)
+      goto again;
+  }
+
+  // there is room in flight again.
+  dispatch(d);
+}
+
+// histogram bucket for a latency of us microseconds.
+static int
+latbucket(uint64 us)
+{
+  int e;
+
+  if(us < 4)
+    return us;
+  for(e = 2; (us >> (e+1)) != 0; e++)
+    ;
+  // four buckets per power of two, by the two bits below the top.
+  int i = 4*(e-1) + ((us >> (e-2)) & 3);
+  return i < NLATBUCKET ? i : NLATBUCKET-1;
+}
+
+// spin for up to POLLUS for b's request to finish, reaping
+// completions as they appear. interrupts from the device are
+// suppressed meanwhile. returns 1 if b finished.
+// caller holds vdisk_lock.
+static int
+pollwait(struct disk *d, struct buf *b)
+{
+  uint64 end = r_time() + POLLUS * (TIMEFREQ / 1000000);
+
+  if(d->polling++ == 0)
+    intr_enable(d, 0);
+  while(b->disk == 1 && r_time() < end){
+    // spin without the lock, so the interrupt handler and
+    // other CPUs are not held up.
+    release(&d->vdisk_lock);
+    while(*(volatile uint16 *)&d->used->idx == d->used_idx &&
+          r_time() < end)
+      ;
+    acquire(&d->vdisk_lock);
+    reap(d);
+  }
+  if(--d->polling == 0){
+    // a completion may have come in after the last look
+    // but before interrupts were back on.
+    intr_enable(d, 1);
+    reap(d);
+  }
+  return b->disk == 0;
+}
+
+// wait for b's request to finish: spin for a while in polled
+// mode, else sleep until virtio_disk_intr() says it is done.
+void
+virtio_disk_wait(struct buf *b)
+{
+  struct disk *d = devdisk(b->dev);
+  int polled = 0;
+
+  acquire(&d->vdisk_lock);
+  dispatch(d); // in case b was queued but never kicked
+  if(d->poll && b->disk == 1)
+    polled = pollwait(d, b);
+  while(b->disk == 1) {
+    sleep(b, &d->vdisk_lock);
+  }
+  d->npolled += polled;
+  d->lat[latbucket((r_time() - b->stime) / (TIMEFREQ / 1000000))]++;
+  release(&d->vdisk_lock);
+}
+
+// switch polled completion on (1) or off (0); -1 just looks.
+// returns the previous setting, or -1.
+int
+virtio_disk_poll(int on)
+{
+  struct disk *d;
+  int old;
+
+  if(on < -1 || on > 1)
+    return -1;
+  old = disks[0].poll;
+  for(d = disks; d < disks + NDISK; d++){
+    if(d->dev == 0)
+      continue;
+    acquire(&d->vdisk_lock);
+    if(on >= 0)
+      d->poll = on;
+    release(&d->vdisk_lock);
+  }
+  return old;
+}
 
-    disk.used_idx += 1;
+// report request counters, summed over the disks.
+void
+virtio_disk_stats(struct kstat *st)
+{
+  struct disk *d;
+
+  for(d = disks; d < disks + NDISK; d++){
+    if(d->dev == 0)
+      continue;
+    acquire(&d->vdisk_lock);
+    st->diskreqs += d->nreq;
+    st->diskblocks += d->nblk;
+    st->diskpolled += d->npolled;
+    for(int i = 0; i < NLATBUCKET; i++)
+      st->disklat[i] += d->lat[i];
+    release(&d->vdisk_lock);
   }
+}
+
+// interrupt from disk i.
+void
+virtio_disk_intr(int i)
+{
+  struct disk *d = &disks[i];
+
+  acquire(&d->vdisk_lock);
+
+  // the device won't raise another interrupt until we tell it
+  // we've seen this interrupt, which the following line does.
+  // this may race with the device writing new entries to
+  // the "used" ring, in which case we may process the new
+  // completion entries in this interrupt, and have nothing to do
+  // in the next interrupt, which is harmless. completions that
+  // come in while reap() re-arms used_event, and so raise no
+  // interrupt, are caught by reap() looking again afterwards.
+  *R(d, VIRTIO_MMIO_INTERRUPT_ACK) = *R(d, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+
+  reap(d);
 
-  release(&disk.vdisk_lock);
+  release(&d->vdisk_lock);
 }
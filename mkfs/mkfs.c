@@ -19,11 +19,14 @@
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// With -j dev the log is on device dev instead, in the nlog blocks
+// after FSSIZE that mkfs -J leaves there.
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nlog = 2*(LOGSIZE+1);  // two slots: header + LOGSIZE blocks
+int nlogin;   // Number of those in this image: none with -j
+int nmeta;    // Number of meta blocks (boot, sb, nlogin, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
@@ -31,6 +34,12 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+int extents = 1;  // extent-mapped files; -b for block maps
+int dxdirs = 1;   // indexed directories; -l for linear ones only
+int logdev = 0;   // -j: device to keep the log on
+int logroom = 0;  // -J: leave room after the fs for another's log
+struct dirent rootents[NINODES];  // root's entries, but . and ..
+int nroot;
 
 
 void balloc(int);
@@ -40,6 +49,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dxwrite(uint inum, struct dirent *de, int n);
 void die(const char *);
 
 // convert to riscv byte order
@@ -70,15 +80,28 @@ main(int argc, char *argv[])
 {
   int i, cc, fd;
   uint rootino, inum, off;
-  struct dirent de;
+  struct dirent de, *rde;
   char buf[BSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  for(; argc > 1 && argv[1][0] == '-'; argc--, argv++){
+    if(strcmp(argv[1], "-b") == 0)
+      extents = 0;
+    else if(strcmp(argv[1], "-l") == 0)
+      dxdirs = 0;
+    else if(strcmp(argv[1], "-j") == 0 && argc > 2 && atoi(argv[2]) > 0){
+      logdev = atoi(argv[2]);
+      argc--, argv++;
+    } else if(strcmp(argv[1], "-J") == 0)
+      logroom = 1;
+    else
+      break;
+  }
+  if(argc < 2 || argv[1][0] == '-'){
+    fprintf(stderr, "Usage: mkfs [-b] [-l] [-j logdev] [-J] fs.img files...\n");
     exit(1);
   }
 
@@ -90,7 +113,8 @@ main(int argc, char *argv[])
     die(argv[1]);
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  nlogin = logdev ? 0 : nlog;
+  nmeta = 2 + nlogin + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
   sb.magic = FSMAGIC;
@@ -98,16 +122,21 @@ main(int argc, char *argv[])
   sb.nblocks = xint(nblocks);
   sb.ninodes = xint(NINODES);
   sb.nlog = xint(nlog);
-  sb.logstart = xint(2);
-  sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.logstart = xint(logdev ? FSSIZE : 2);
+  sb.inodestart = xint(2+nlogin);
+  sb.bmapstart = xint(2+nlogin+ninodeblocks);
+  sb.flags = xint((extents ? FS_EXTENT : 0) | (dxdirs ? FS_DXDIR : 0) |
+                  FS_INLINE);
+  sb.logdev = xint(logdev);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlogin, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  if(logdev)
+    printf("log blocks %u at %u on device %d\n", nlog, FSSIZE, logdev);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < FSSIZE + (logroom ? nlog : 0); i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -149,10 +178,9 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rde = &rootents[nroot++];
+    rde->inum = xshort(inum);
+    strncpy(rde->name, shortname, DIRSIZ);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,12 +188,18 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(dxdirs && 2 + nroot > DPB){
+    dxwrite(rootino, rootents, nroot);
+  } else {
+    iappend(rootino, rootents, nroot * sizeof(struct dirent));
+
+    // fix size of root inode dir
+    rinode(rootino, &din);
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
 
@@ -227,6 +261,7 @@ ialloc(ushort type)
   din.type = xshort(type);
   din.nlink = xshort(1);
   din.size = xint(0);
+  din.flags = xshort(extents ? I_EXTENT : 0);
   winode(inum, &din);
   return inum;
 }
@@ -249,6 +284,80 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block for file block fbn of extent-mapped
+// din, allocating it if fbn is just past the end. Files are
+// written one at a time, so each is a few runs of blocks and
+// its extents fit in the inode.
+uint
+emap(struct dinode *din, uint fbn)
+{
+  struct extenthdr *h = (struct extenthdr*)din->addrs;
+  struct extent *e = (struct extent*)(h + 1);
+  int n = xshort(h->n);
+  uint end;
+
+  if(n > 0){
+    end = xint(e[n-1].lblk) + xint(e[n-1].len);
+    if(fbn < end)
+      return xint(e[n-1].start) + fbn - xint(e[n-1].lblk);
+    assert(fbn == end);
+    if(xint(e[n-1].start) + xint(e[n-1].len) == freeblock){
+      e[n-1].len = xint(xint(e[n-1].len) + 1);
+      return freeblock++;
+    }
+  }
+  assert(n < NEXTROOT);
+  e[n].lblk = xint(fbn);
+  e[n].start = xint(freeblock);
+  e[n].len = xint(1);
+  h->n = xshort(n + 1);
+  return freeblock++;
+}
+
+// Return the disk block for file block fbn of block-mapped
+// din, allocating it and any indirect blocks on the way.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint addr, span;
+  int level, i;
+
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0)
+      din->addrs[fbn] = xint(freeblock++);
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+  for(level = 1, span = NINDIRECT; fbn >= span; level++, span *= NINDIRECT){
+    assert(level < 3);
+    fbn -= span;
+  }
+  if(xint(din->addrs[NDIRECT + level - 1]) == 0)
+    din->addrs[NDIRECT + level - 1] = xint(freeblock++);
+  addr = xint(din->addrs[NDIRECT + level - 1]);
+  for(; level > 0; level--){
+    span /= NINDIRECT;
+    rsect(addr, (char*)indirect);
+    i = (fbn / span) % NINDIRECT;
+    if(indirect[i] == 0){
+      indirect[i] = xint(freeblock++);
+      wsect(addr, (char*)indirect);
+    }
+    addr = xint(indirect[i]);
+  }
+  return addr;
+}
+
+// The disk block for file block fbn, allocating it if need be.
+uint
+fmap(struct dinode *din, uint fbn)
+{
+  if(xshort(din->flags) & I_EXTENT)
+    return emap(din, fbn);
+  return bmap(din, fbn);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +365,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -264,23 +372,7 @@ iappend(uint inum, void *xp, int n)
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = fmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -293,6 +385,79 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Hash of a name for a directory index; as dxhash() in kernel/fs.c.
+uint
+dxhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+int
+dxcmp(const void *a, const void *b)
+{
+  uint ha = dxhash(((struct dirent*)a)->name);
+  uint hb = dxhash(((struct dirent*)b)->name);
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Append n entries to directory inum, which holds just . and ..,
+// as an indexed directory: leaves about three quarters full, in
+// hash order, under a root with one level of index.
+void
+dxwrite(uint inum, struct dirent *de, int n)
+{
+  char root[BSIZE], leaf[BSIZE];
+  struct dxhdr *hd;
+  struct dxentry *e;
+  struct dinode din;
+  uint rootbn;
+  int i, j, nleaf;
+
+  qsort(de, n, sizeof(*de), dxcmp);
+  rinode(inum, &din);
+  assert(xint(din.size) == 2*sizeof(struct dirent));
+  rootbn = fmap(&din, 0);
+  rsect(rootbn, root);
+  hd = (struct dxhdr*)(root + 2*sizeof(struct dirent));
+  e = (struct dxentry*)(hd + 1);
+
+  // leaves first, so the root can say where they start.
+  din.size = xint(BSIZE);
+  winode(inum, &din);
+  nleaf = 0;
+  for(i = 0; i < n; i = j){
+    if(nleaf == DXROOT){
+      fprintf(stderr, "mkfs: too many files for the root index\n");
+      exit(1);
+    }
+    // don't split a run of one hash between leaves.
+    for(j = i + min(n - i, DPB*3/4); j < n && j - i < DPB &&
+        dxhash(de[j].name) == dxhash(de[j-1].name); j++)
+      ;
+    if(j < n && dxhash(de[j].name) == dxhash(de[j-1].name)){
+      fprintf(stderr, "mkfs: too many names with one hash\n");
+      exit(1);
+    }
+    bzero(leaf, sizeof(leaf));
+    memmove(leaf, de + i, (j - i) * sizeof(*de));
+    e[nleaf].hash = xint(nleaf == 0 ? 0 : dxhash(de[i].name));
+    e[nleaf].block = xint(nleaf + 1);
+    nleaf++;
+    iappend(inum, leaf, BSIZE);
+  }
+  hd->n = xshort(nleaf);
+  hd->depth = 0;
+
+  rinode(inum, &din);
+  din.flags = xshort(xshort(din.flags) | I_DXDIR);
+  winode(inum, &din);
+  wsect(rootbn, root);
+}
+
 void
 die(const char *s)
 {
@@ -0,0 +1,98 @@
+// Measure how directory operations scale with directory size.
+// Fills one directory with N names (default 10000), timing
+// each thousand, then looks them all up and removes them.
+// With an indexed directory the time per thousand should not
+// grow with the number already there.
+//
+// The file system has far fewer inodes than that, so the
+// names are hard links to one file.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define DIR  "dirbench.d"
+#define STEP 1000
+
+void
+mkname(char *buf, int i)
+{
+  char *p;
+  int n;
+
+  strcpy(buf, DIR "/f");
+  p = buf + strlen(buf);
+  n = 1;
+  for(int x = i; x >= 10; x /= 10)
+    n++;
+  p[n] = '\0';
+  while(n-- > 0){
+    p[n] = '0' + i % 10;
+    i /= 10;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[32], first[32];
+  int n, i, fd, t0, t1;
+
+  n = argc > 1 ? atoi(argv[1]) : 10000;
+
+  if(mkdir(DIR) < 0){
+    fprintf(2, "dirbench: mkdir %s failed\n", DIR);
+    exit(1);
+  }
+  mkname(name, 0);
+  if((fd = open(name, O_CREATE|O_WRONLY)) < 0){
+    fprintf(2, "dirbench: create %s failed\n", name);
+    exit(1);
+  }
+  close(fd);
+  strcpy(first, name);
+
+  t0 = uptime();
+  for(i = 1; i < n; i++){
+    mkname(name, i);
+    if(link(first, name) < 0){
+      fprintf(2, "dirbench: link %s failed\n", name);
+      exit(1);
+    }
+    if((i + 1) % STEP == 0){
+      t1 = uptime();
+      printf("create %d-%d: %d ticks\n", i + 1 - STEP, i + 1, t1 - t0);
+      t0 = t1;
+    }
+  }
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(name, i);
+    if((fd = open(name, O_RDONLY)) < 0){
+      fprintf(2, "dirbench: open %s failed\n", name);
+      exit(1);
+    }
+    close(fd);
+  }
+  t1 = uptime();
+  printf("open %d: %d ticks\n", n, t1 - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(name, i);
+    if(unlink(name) < 0){
+      fprintf(2, "dirbench: unlink %s failed\n", name);
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  printf("unlink %d: %d ticks\n", n, t1 - t0);
+
+  if(unlink(DIR) < 0){
+    fprintf(2, "dirbench: unlink %s failed\n", DIR);
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,111 @@
+// Disk read latency under a write flood, for each I/O
+// scheduler policy. Writers rewrite their own files in
+// stressfs fashion, keeping commit() busy; one reader
+// streams through a file too big for the buffer cache, so
+// every read goes to the disk. Reports how many blocks the
+// reader got and its worst single-read time.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/sysctl.h"
+#include "user/user.h"
+
+#define NWRITER   4
+#define RBLOCKS 250   // well over NBUF
+#define WBLOCKS  20
+#define DURATION 50   // ticks per policy
+
+char buf[BSIZE];
+
+void
+writer(int i, int end)
+{
+  char name[] = "disklat.w0";
+  int fd, j;
+
+  name[9] += i;
+  memset(buf, 'a' + i, sizeof(buf));
+  while(uptime() < end){
+    if((fd = open(name, O_CREATE | O_RDWR | O_TRUNC)) < 0){
+      printf("disklat: cannot create %s\n", name);
+      exit(1);
+    }
+    for(j = 0; j < WBLOCKS; j++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+  unlink(name);
+  exit(0);
+}
+
+void
+reader(char *policy, int end)
+{
+  int fd, n, t0, t, worst, nread;
+
+  worst = nread = 0;
+  fd = -1;
+  while(uptime() < end){
+    if(fd < 0 && (fd = open("disklat.r", O_RDONLY)) < 0){
+      printf("disklat: cannot open disklat.r\n");
+      exit(1);
+    }
+    t0 = uptime();
+    n = read(fd, buf, sizeof(buf));
+    t = uptime() - t0;
+    if(n <= 0){
+      close(fd);
+      fd = -1;
+      continue;
+    }
+    nread++;
+    if(t > worst)
+      worst = t;
+  }
+  printf("%s: %d blocks read in %d ticks, worst read %d ticks\n",
+         policy, nread, DURATION, worst);
+  exit(0);
+}
+
+void
+run(char *name, int policy)
+{
+  int i, end;
+
+  if(sysctl(CTL_IOSCHED, policy) < 0){
+    printf("disklat: no %s scheduler\n", name);
+    return;
+  }
+  end = uptime() + DURATION;
+  for(i = 0; i < NWRITER; i++)
+    if(fork() == 0)
+      writer(i, end);
+  if(fork() == 0)
+    reader(name, end);
+  for(i = 0; i < NWRITER + 1; i++)
+    wait(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, old;
+
+  if((fd = open("disklat.r", O_CREATE | O_RDWR)) < 0){
+    printf("disklat: cannot create disklat.r\n");
+    exit(1);
+  }
+  memset(buf, 'r', sizeof(buf));
+  for(i = 0; i < RBLOCKS; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+
+  old = sysctl(CTL_IOSCHED, -1);
+  run("noop", IOSCHED_NOOP);
+  run("deadline", IOSCHED_DEADLINE);
+  sysctl(CTL_IOSCHED, old);
+
+  unlink("disklat.r");
+  exit(0);
+}
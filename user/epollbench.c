@@ -0,0 +1,131 @@
+// Measure epoll_wait() against the size of the interest set.
+// Registers the read ends of N pipes with one epoll instance,
+// keeps only a few of them busy, and times a fixed number of
+// write/epoll_wait/read rounds. The time per round should not
+// grow with N.
+//
+// A process can't hold 1000 pipes, so the idle ones are made
+// BATCH at a time and handed to a holder child, which keeps
+// them open while this process closes its copies; their items
+// stay registered.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/epoll.h"
+#include "user/user.h"
+
+#define MAXPIPES 1000
+#define BATCH    100   // both ends of each fit in NOFILE
+#define NACTIVE  4
+#define ROUNDS   2000
+
+int act[NACTIVE][2];
+int idle[BATCH][2];
+
+// Fork a child that holds the idle pipes until ctl's write
+// end is closed.
+void
+holder(int ctl[2])
+{
+  char c;
+  int pid;
+
+  if((pid = fork()) < 0){
+    printf("epollbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(ctl[1]);
+    read(ctl[0], &c, 1);
+    exit(0);
+  }
+}
+
+void
+bench(int npipes)
+{
+  struct epoll_event ev, evs[NACTIVE];
+  int ep, ctl[2], i, j, r, n, got, nheld, nholders;
+  char c;
+
+  if((ep = epoll_create()) < 0 || pipe(ctl) < 0){
+    printf("epollbench: epoll_create failed\n");
+    exit(1);
+  }
+  for(i = 0; i < NACTIVE; i++){
+    if(pipe(act[i]) < 0){
+      printf("epollbench: pipe failed\n");
+      exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data = i;
+    if(epoll_ctl(ep, EPOLL_CTL_ADD, act[i][0], &ev) < 0){
+      printf("epollbench: epoll_ctl failed\n");
+      exit(1);
+    }
+  }
+  nholders = 0;
+  for(nheld = NACTIVE; nheld < npipes; nheld += j){
+    for(j = 0; j < BATCH && nheld + j < npipes; j++){
+      if(pipe(idle[j]) < 0){
+        printf("epollbench: pipe %d failed\n", nheld + j);
+        exit(1);
+      }
+      ev.events = EPOLLIN;
+      ev.data = nheld + j;
+      if(epoll_ctl(ep, EPOLL_CTL_ADD, idle[j][0], &ev) < 0){
+        printf("epollbench: epoll_ctl %d failed\n", nheld + j);
+        exit(1);
+      }
+    }
+    holder(ctl);
+    nholders++;
+    for(i = 0; i < j; i++){
+      close(idle[i][0]);
+      close(idle[i][1]);
+    }
+  }
+
+  int t0 = uptime();
+  for(r = 0; r < ROUNDS; r++){
+    for(i = 0; i < NACTIVE; i++)
+      write(act[i][1], "x", 1);
+    for(got = 0; got < NACTIVE; got += n){
+      if((n = epoll_wait(ep, evs, NACTIVE, -1)) <= 0){
+        printf("epollbench: epoll_wait failed\n");
+        exit(1);
+      }
+      for(i = 0; i < n; i++){
+        if(evs[i].data >= NACTIVE){
+          printf("epollbench: idle pipe %d ready\n", (int)evs[i].data);
+          exit(1);
+        }
+        read(act[evs[i].data][0], &c, 1);
+      }
+    }
+  }
+  int t1 = uptime();
+
+  printf("%d pipes, %d active: %d rounds in %d ticks\n",
+         npipes, NACTIVE, ROUNDS, t1 - t0);
+
+  close(ep);
+  close(ctl[0]);
+  close(ctl[1]);
+  for(i = 0; i < nholders; i++)
+    wait(0);
+  for(i = 0; i < NACTIVE; i++){
+    close(act[i][0]);
+    close(act[i][1]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  bench(NACTIVE);
+  bench(10);
+  bench(100);
+  bench(MAXPIPES);
+  exit(0);
+}
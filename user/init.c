@@ -4,6 +4,7 @@
 #include "kernel/stat.h"
 #include "kernel/spinlock.h"
 #include "kernel/sleeplock.h"
+#include "kernel/param.h"
 #include "kernel/fs.h"
 #include "kernel/file.h"
 #include "user/user.h"
@@ -23,6 +24,15 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // scratch files go in memory.
+  mkdir("/tmp");
+  if(mount("/tmp", TMPDEV) < 0)
+    printf("init: mount /tmp failed\n");
+
+  // a second disk, if there is one.
+  mkdir("/disk1");
+  mount("/disk1", DISKDEV + 1);
+
   for(;;){
     printf("init: starting sh\n");
     pid = fork();
@@ -0,0 +1,60 @@
+// Print the kernel's I/O counters. With arguments,
+// run the command and print the counters it caused.
+
+#include "kernel/types.h"
+#include "kernel/kstat.h"
+#include "user/user.h"
+
+void
+show(struct kstat *a, struct kstat *b)
+{
+  uint64 reqs = b->diskreqs - a->diskreqs;
+  uint64 blocks = b->diskblocks - a->diskblocks;
+
+  printf("disk requests %d, blocks %d", (int)reqs, (int)blocks);
+  if(reqs > 0)
+    printf(", %d.%d blocks/request",
+           (int)(blocks / reqs), (int)((blocks * 10 / reqs) % 10));
+  printf(", read ahead %d, commits %d\n", (int)(b->readahead - a->readahead),
+         (int)(b->commits - a->commits));
+
+  uint64 hits = b->dcachehits - a->dcachehits;
+  uint64 neg = b->dcacheneg - a->dcacheneg;
+  uint64 misses = b->dcachemisses - a->dcachemisses;
+  printf("dcache hits %d (negative %d), misses %d", (int)(hits + neg),
+         (int)neg, (int)misses);
+  if(hits + neg + misses > 0)
+    printf(", %d%% hit", (int)((hits + neg) * 100 / (hits + neg + misses)));
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct kstat zero, before, after;
+
+  memset(&zero, 0, sizeof(zero));
+  if(kstat(&before) < 0){
+    fprintf(2, "iostat: kstat failed\n");
+    exit(1);
+  }
+  if(argc < 2){
+    show(&zero, &before);
+    exit(0);
+  }
+
+  int pid = fork();
+  if(pid < 0){
+    fprintf(2, "iostat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "iostat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  kstat(&after);
+  show(&before, &after);
+  exit(0);
+}
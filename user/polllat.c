@@ -0,0 +1,125 @@
+// Per-request disk latency with interrupt-driven and polled
+// completion. Runs the same small synchronous I/O in each
+// mode -- block-at-a-time reads that miss in the buffer cache,
+// and file creates and deletes -- and prints the p50 and p99
+// of the kernel's wait latency histogram.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/kstat.h"
+#include "kernel/sysctl.h"
+#include "user/user.h"
+
+#define NBLOCKS 120   // well over NBUF
+#define NPASS     4
+#define NFILES   20
+
+char buf[BSIZE];
+
+// lower bound, in microseconds, of histogram bucket i.
+uint64
+bucketus(int i)
+{
+  if(i < 4)
+    return i;
+  return (uint64)(4 + i % 4) << (i / 4 - 1);
+}
+
+// latency below which pct percent of the waits fell.
+uint64
+percentile(uint64 *h, uint64 total, int pct)
+{
+  uint64 sum = 0;
+  int i;
+
+  for(i = 0; i < NLATBUCKET; i++){
+    sum += h[i];
+    if(sum * 100 >= total * pct)
+      break;
+  }
+  if(i + 1 >= NLATBUCKET)
+    return bucketus(NLATBUCKET - 1);
+  return bucketus(i + 1);
+}
+
+void
+workload(void)
+{
+  char name[] = "polllat.f00";
+  int fd, i, p;
+
+  for(p = 0; p < NPASS; p++){
+    if((fd = open("polllat.r", O_RDONLY)) < 0){
+      printf("polllat: cannot open polllat.r\n");
+      exit(1);
+    }
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+  for(i = 0; i < NFILES; i++){
+    name[9] = '0' + i / 10;
+    name[10] = '0' + i % 10;
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+      printf("polllat: cannot create %s\n", name);
+      exit(1);
+    }
+    write(fd, "x", 1);
+    close(fd);
+  }
+  for(i = 0; i < NFILES; i++){
+    name[9] = '0' + i / 10;
+    name[10] = '0' + i % 10;
+    unlink(name);
+  }
+}
+
+void
+run(char *mode, int poll)
+{
+  struct kstat a, b;
+  uint64 h[NLATBUCKET], total;
+  int i;
+
+  sysctl(CTL_DISKPOLL, poll);
+  kstat(&a);
+  workload();
+  kstat(&b);
+
+  total = 0;
+  for(i = 0; i < NLATBUCKET; i++){
+    h[i] = b.disklat[i] - a.disklat[i];
+    total += h[i];
+  }
+  if(total == 0){
+    printf("%s: no disk waits\n", mode);
+    return;
+  }
+  printf("%s: %d waits (%d polled), p50 < %dus, p99 < %dus\n",
+         mode, (int)total, (int)(b.diskpolled - a.diskpolled),
+         (int)percentile(h, total, 50), (int)percentile(h, total, 99));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, old;
+
+  if((fd = open("polllat.r", O_CREATE | O_RDWR)) < 0){
+    printf("polllat: cannot create polllat.r\n");
+    exit(1);
+  }
+  memset(buf, 'r', sizeof(buf));
+  for(i = 0; i < NBLOCKS; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+
+  old = sysctl(CTL_DISKPOLL, -1);
+  run("interrupt", 0);
+  run("polled", 1);
+  sysctl(CTL_DISKPOLL, old);
+
+  unlink("polllat.r");
+  exit(0);
+}
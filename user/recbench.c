@@ -0,0 +1,139 @@
+// Record-oriented I/O: a file of fixed-size records, each a
+// small header and a payload kept in separate buffers.
+// Times writing and reading them with one write()/read() per
+// buffer against one writev()/readv() per record, and
+// fetching records out of order with pread().
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/iovec.h"
+#include "user/user.h"
+
+#define FILE    "recbench.dat"
+#define NREC    500
+#define HDRSZ   16
+#define DATASZ  240
+#define RECSZ   (HDRSZ + DATASZ)
+
+char hdr[HDRSZ];
+char data[DATASZ];
+
+void
+fail(char *what)
+{
+  fprintf(2, "recbench: %s failed\n", what);
+  unlink(FILE);
+  exit(1);
+}
+
+// one of each test, returning ticks taken.
+int
+writeplain(void)
+{
+  int fd, i, t0;
+
+  if((fd = open(FILE, O_CREATE|O_TRUNC|O_WRONLY)) < 0)
+    fail("create");
+  t0 = uptime();
+  for(i = 0; i < NREC; i++){
+    hdr[0] = i;
+    if(write(fd, hdr, HDRSZ) != HDRSZ || write(fd, data, DATASZ) != DATASZ)
+      fail("write");
+  }
+  close(fd);
+  return uptime() - t0;
+}
+
+int
+writevec(void)
+{
+  struct iovec iov[2];
+  int fd, i, t0;
+
+  if((fd = open(FILE, O_CREATE|O_TRUNC|O_WRONLY)) < 0)
+    fail("create");
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = HDRSZ;
+  iov[1].iov_base = data;
+  iov[1].iov_len = DATASZ;
+  t0 = uptime();
+  for(i = 0; i < NREC; i++){
+    hdr[0] = i;
+    if(writev(fd, iov, 2) != RECSZ)
+      fail("writev");
+  }
+  close(fd);
+  return uptime() - t0;
+}
+
+int
+readplain(void)
+{
+  int fd, i, t0;
+
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    fail("open");
+  t0 = uptime();
+  for(i = 0; i < NREC; i++){
+    if(read(fd, hdr, HDRSZ) != HDRSZ || read(fd, data, DATASZ) != DATASZ)
+      fail("read");
+    if(hdr[0] != (char)i)
+      fail("read check");
+  }
+  close(fd);
+  return uptime() - t0;
+}
+
+int
+readvec(void)
+{
+  struct iovec iov[2];
+  int fd, i, t0;
+
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    fail("open");
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = HDRSZ;
+  iov[1].iov_base = data;
+  iov[1].iov_len = DATASZ;
+  t0 = uptime();
+  for(i = 0; i < NREC; i++){
+    if(readv(fd, iov, 2) != RECSZ)
+      fail("readv");
+    if(hdr[0] != (char)i)
+      fail("readv check");
+  }
+  close(fd);
+  return uptime() - t0;
+}
+
+int
+readpos(void)
+{
+  int fd, i, r, t0;
+
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    fail("open");
+  t0 = uptime();
+  for(i = 0; i < NREC; i++){
+    r = (i * 7919) % NREC;  // visit every record, out of order
+    if(pread(fd, hdr, HDRSZ, r * RECSZ) != HDRSZ)
+      fail("pread");
+    if(hdr[0] != (char)r)
+      fail("pread check");
+  }
+  close(fd);
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  memset(data, 'd', DATASZ);
+  printf("%d records of %d+%d bytes, in ticks:\n", NREC, HDRSZ, DATASZ);
+  printf("write %d, writev %d\n", writeplain(), writevec());
+  printf("read %d, readv %d, pread (scattered) %d\n",
+         readplain(), readvec(), readpos());
+  unlink(FILE);
+  exit(0);
+}
@@ -0,0 +1,70 @@
+// Small appends, with the log committing after every write,
+// then with commits batched every few ticks (sysctl
+// CTL_COMMIT), then batched but with an fsync() after every
+// SYNCEVERY writes. Prints the time and the commits each
+// took.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/kstat.h"
+#include "kernel/sysctl.h"
+#include "user/user.h"
+
+#define FILE      "syncbench.dat"
+#define NWRITE    500
+#define WSIZE     100
+#define INTERVAL  10    // ticks
+#define SYNCEVERY 50
+
+char data[WSIZE];
+
+void
+run(char *what, int interval, int syncevery)
+{
+  struct kstat st;
+  uint64 c0;
+  int fd, i, t0;
+
+  sysctl(CTL_COMMIT, interval);
+  if((fd = open(FILE, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    fprintf(2, "syncbench: create failed\n");
+    exit(1);
+  }
+  kstat(&st);
+  c0 = st.commits;
+  t0 = uptime();
+  for(i = 0; i < NWRITE; i++){
+    if(write(fd, data, WSIZE) != WSIZE){
+      fprintf(2, "syncbench: write failed\n");
+      exit(1);
+    }
+    if(syncevery && (i + 1) % syncevery == 0 && fsync(fd) < 0){
+      fprintf(2, "syncbench: fsync failed\n");
+      exit(1);
+    }
+  }
+  if(fsync(fd) < 0){
+    fprintf(2, "syncbench: fsync failed\n");
+    exit(1);
+  }
+  printf("%s: %d ticks, ", what, uptime() - t0);
+  kstat(&st);
+  printf("%d commits\n", (int)(st.commits - c0));
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int old;
+
+  memset(data, 'x', WSIZE);
+  old = sysctl(CTL_COMMIT, -1);
+  printf("%d writes of %d bytes:\n", NWRITE, WSIZE);
+  run("commit each write", 0, 0);
+  run("commit every 10 ticks", INTERVAL, 0);
+  run("... and fsync every 50 writes", INTERVAL, SYNCEVERY);
+  sysctl(CTL_COMMIT, old);
+  unlink(FILE);
+  exit(0);
+}
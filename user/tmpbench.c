@@ -0,0 +1,63 @@
+// Scratch-file workload: create, write, read back and remove
+// NFILES files of FSIZE bytes, NROUND times, first in the
+// current directory on disk and then in tmpfs at /tmp.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NFILES  20
+#define FSIZE   4096
+#define NROUND  5
+
+char buf[FSIZE];
+
+void
+mkname(char *name, char *dir, int i)
+{
+  strcpy(name, dir);
+  strcpy(name + strlen(name), "/tb.00");
+  name[strlen(name) - 2] = '0' + i / 10;
+  name[strlen(name) - 1] = '0' + i % 10;
+}
+
+int
+run(char *dir)
+{
+  char name[32];
+  int fd, i, r, t0;
+
+  t0 = uptime();
+  for(r = 0; r < NROUND; r++){
+    for(i = 0; i < NFILES; i++){
+      mkname(name, dir, i);
+      if((fd = open(name, O_CREATE|O_TRUNC|O_WRONLY)) < 0 ||
+         write(fd, buf, FSIZE) != FSIZE){
+        fprintf(2, "tmpbench: write %s failed\n", name);
+        exit(1);
+      }
+      close(fd);
+    }
+    for(i = 0; i < NFILES; i++){
+      mkname(name, dir, i);
+      if((fd = open(name, O_RDONLY)) < 0 || read(fd, buf, FSIZE) != FSIZE){
+        fprintf(2, "tmpbench: read %s failed\n", name);
+        exit(1);
+      }
+      close(fd);
+      unlink(name);
+    }
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  memset(buf, 't', FSIZE);
+  printf("%d rounds of %d files of %d bytes, in ticks:\n",
+         NROUND, NFILES, FSIZE);
+  printf("disk %d\n", run("."));
+  printf("tmpfs %d\n", run("/tmp"));
+  exit(0);
+}
@@ -1,4 +1,7 @@
 struct stat;
+struct epoll_event;
+struct kstat;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -23,6 +26,21 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int lock(int, int);
+int epoll_create(void);
+int epoll_ctl(int, int, int, struct epoll_event*);
+int epoll_wait(int, struct epoll_event*, int, int);
+int kstat(struct kstat*);
+int sysctl(int, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int lseek(int, int, int);
+int ftruncate(int, int);
+int fallocate(int, int, int, int);
+int fsync(int);
+int fdatasync(int);
+int mount(const char*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -7,6 +7,10 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/epoll.h"
+#include "kernel/iovec.h"
+#include "kernel/kstat.h"
+#include "kernel/sysctl.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -575,9 +579,11 @@ writetest(char *s)
   }
 }
 
+// big enough to need a double-indirect block.
 void
 writebig(char *s)
 {
+  enum { NBIG = NDIRECT + NINDIRECT + 64 };
   int i, fd, n;
 
   fd = open("big", O_CREATE|O_RDWR);
@@ -586,7 +592,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +612,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -629,6 +635,629 @@ writebig(char *s)
   }
 }
 
+// a file longer than a single indirect block can map, whose
+// first blocks are interleaved with another file's so that
+// they are split over more extents than the inode holds,
+// forcing the extent tree to grow below the inode.
+void
+extentfile(char *s)
+{
+  enum { NA = NDIRECT + NINDIRECT + 32, NB = 100 };
+  int fa, fb, i, n;
+
+  unlink("extent.a");
+  unlink("extent.b");
+  fa = open("extent.a", O_CREATE|O_RDWR);
+  fb = open("extent.b", O_CREATE|O_RDWR);
+  if(fa < 0 || fb < 0){
+    printf("%s: create extent files failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NA; i++){
+    ((int*)buf)[0] = i;
+    if(write(fa, buf, BSIZE) != BSIZE){
+      printf("%s: write extent.a block %d failed\n", s, i);
+      exit(1);
+    }
+    if(i < NB && write(fb, buf, BSIZE) != BSIZE){
+      printf("%s: write extent.b block %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  close(fa);
+  close(fb);
+
+  fa = open("extent.a", O_RDONLY);
+  if(fa < 0){
+    printf("%s: open extent.a failed\n", s);
+    exit(1);
+  }
+  for(i = 0; (n = read(fa, buf, BSIZE)) == BSIZE; i++){
+    if(((int*)buf)[0] != i){
+      printf("%s: block %d of extent.a is %d\n", s, i, ((int*)buf)[0]);
+      exit(1);
+    }
+  }
+  close(fa);
+  if(n != 0 || i != NA){
+    printf("%s: read %d blocks of extent.a\n", s, i);
+    exit(1);
+  }
+  if(unlink("extent.a") < 0 || unlink("extent.b") < 0){
+    printf("%s: unlink extent files failed\n", s);
+    exit(1);
+  }
+}
+
+// data held back from allocation must read back before it
+// reaches the disk, vanish when the file is truncated, and
+// be there after the file is closed.
+void
+delalloc(char *s)
+{
+  enum { N = 150, SZ = 500 };
+  int fw, fr, fd, i, j, n;
+  struct stat st;
+
+  unlink("delalloc");
+  fw = open("delalloc", O_CREATE|O_WRONLY);
+  fr = open("delalloc", O_RDONLY);
+  if(fw < 0 || fr < 0){
+    printf("%s: open delalloc failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, 'a' + i % 26, SZ);
+    if(write(fw, buf, SZ) != SZ){
+      printf("%s: write delalloc failed\n", s);
+      exit(1);
+    }
+    // read it back while the writer still has it open.
+    if(read(fr, buf, SZ) != SZ){
+      printf("%s: read delalloc %d failed\n", s, i);
+      exit(1);
+    }
+    for(j = 0; j < SZ; j++){
+      if(buf[j] != 'a' + i % 26){
+        printf("%s: delalloc piece %d is wrong\n", s, i);
+        exit(1);
+      }
+    }
+  }
+  if(fstat(fw, &st) < 0 || st.size != N*SZ){
+    printf("%s: delalloc has size %d\n", s, st.size);
+    exit(1);
+  }
+
+  // truncate, with blocks still held back, and write again.
+  fd = open("delalloc", O_WRONLY|O_TRUNC);
+  if(fd < 0 || write(fd, "xyz", 3) != 3){
+    printf("%s: truncate delalloc failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fw);
+  close(fr);
+
+  fd = open("delalloc", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(n != 3 || buf[0] != 'x' || buf[2] != 'z'){
+    printf("%s: delalloc after truncate: %d bytes\n", s, n);
+    exit(1);
+  }
+
+  // bigger than a batch, then read back after close.
+  fd = open("delalloc", O_WRONLY|O_TRUNC);
+  for(i = 0; i < N; i++){
+    memset(buf, 'a' + i % 26, SZ);
+    if(write(fd, buf, SZ) != SZ){
+      printf("%s: rewrite delalloc failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  fd = open("delalloc", O_RDONLY);
+  for(i = 0; i < N; i++){
+    if(read(fd, buf, SZ) != SZ || buf[0] != 'a' + i % 26 ||
+       buf[SZ-1] != 'a' + i % 26){
+      printf("%s: delalloc piece %d lost\n", s, i);
+      exit(1);
+    }
+  }
+  if(read(fd, buf, 1) != 0){
+    printf("%s: delalloc too long\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("delalloc");
+}
+
+// a small file lives in its inode until it grows.
+void
+inlinefile(char *s)
+{
+  int fd, i, n;
+  struct stat st;
+
+  unlink("inl");
+  fd = open("inl", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10 ||
+     write(fd, "abcdefghij", 10) != 10){
+    printf("%s: write inl failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inl", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(n != 20 || buf[0] != '0' || buf[19] != 'j'){
+    printf("%s: read inl got %d bytes\n", s, n);
+    exit(1);
+  }
+
+  // grow it past the inode, a byte at a time near the edge.
+  fd = open("inl", O_WRONLY);
+  for(i = 0; i < 20; i++)
+    write(fd, "x", 1);  // overwrite
+  for(i = 20; i < 3000; i++){
+    if(write(fd, "abcdefghijklmnopqrstuvwxyz" + i % 26, 1) != 1){
+      printf("%s: append inl %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  if(fstat(fd, &st) < 0 || st.size != 3000){
+    printf("%s: inl has size %d\n", s, st.size);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inl", O_RDONLY);
+  if(read(fd, buf, 3000) != 3000){
+    printf("%s: read grown inl failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < 3000; i++){
+    if(buf[i] != (i < 20 ? 'x' : "abcdefghijklmnopqrstuvwxyz"[i % 26])){
+      printf("%s: grown inl wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  // truncate back to small.
+  fd = open("inl", O_WRONLY|O_TRUNC);
+  if(fd < 0 || write(fd, "tiny", 4) != 4){
+    printf("%s: rewrite inl failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inl", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(n != 4 || buf[0] != 't' || buf[3] != 'y'){
+    printf("%s: truncated inl got %d bytes\n", s, n);
+    exit(1);
+  }
+  unlink("inl");
+}
+
+// positional and vectored reads and writes.
+void
+preadv(char *s)
+{
+  struct iovec iov[3];
+  char a[4], b[6], c[20];
+  int fd, n;
+
+  unlink("prv");
+  fd = open("prv", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf("%s: create prv failed\n", s);
+    exit(1);
+  }
+
+  // pwrite and pread leave the offset alone.
+  if(pwrite(fd, "ab", 2, 3) != 2 || pread(fd, c, 5, 2) != 5 ||
+     memcmp(c, "2ab56", 5) != 0){
+    printf("%s: pwrite/pread wrong\n", s);
+    exit(1);
+  }
+  if(write(fd, "X", 1) != 1 || pread(fd, c, 20, 0) != 11 || c[10] != 'X'){
+    printf("%s: pread moved the offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, c, 5, 11) != 0 || pread(fd, c, 1, -1) != -1){
+    printf("%s: pread past the end\n", s);
+    exit(1);
+  }
+
+  iov[0].iov_base = "hdr:";
+  iov[0].iov_len = 4;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "body!!";
+  iov[2].iov_len = 6;
+  if(writev(fd, iov, 3) != 10){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("prv", O_RDONLY);
+  iov[0].iov_base = c;
+  iov[0].iov_len = 11;
+  iov[1].iov_base = a;
+  iov[1].iov_len = sizeof(a);
+  iov[2].iov_base = b;
+  iov[2].iov_len = sizeof(b);
+  if((n = readv(fd, iov, 3)) != 21 || memcmp(a, "hdr:", 4) != 0 ||
+     memcmp(b, "body!!", 6) != 0){
+    printf("%s: readv got %d\n", s, n);
+    exit(1);
+  }
+  if(readv(fd, iov, 3) != 0 || readv(fd, iov, IOV_MAX + 1) != -1){
+    printf("%s: readv at the end\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // pipes have no offsets.
+  int fds[2];
+  pipe(fds);
+  if(pwrite(fds[1], "x", 1, 0) != -1){
+    printf("%s: pwrite to a pipe\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "p";
+  iov[0].iov_len = 1;
+  iov[1].iov_base = "q";
+  iov[1].iov_len = 1;
+  if(writev(fds[1], iov, 2) != 2 || read(fds[0], c, 2) != 2 || c[1] != 'q'){
+    printf("%s: writev to a pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("prv");
+}
+
+// lseek() past the end leaves a hole; ftruncate() shrinks
+// and grows; fallocate() reserves blocks.
+void
+truncfile(char *s)
+{
+  struct stat st;
+  int fd, i;
+
+  unlink("tf");
+  fd = open("tf", O_CREATE|O_RDWR);
+  for(i = 0; i < 3; i++){
+    memset(buf, 'a' + i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+
+  // shrink into block 1, then grow back: the old bytes
+  // past the cut read as zeros.
+  if(ftruncate(fd, BSIZE + 10) != 0 || lseek(fd, 0, SEEK_END) != BSIZE + 10){
+    printf("%s: ftruncate shrink failed\n", s);
+    exit(1);
+  }
+  if(ftruncate(fd, 3*BSIZE) != 0 || fstat(fd, &st) < 0 || st.size != 3*BSIZE){
+    printf("%s: ftruncate grow failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 3*BSIZE, 0) != 3*BSIZE || buf[BSIZE-1] != 'a' ||
+     buf[BSIZE+9] != 'b'){
+    printf("%s: ftruncate lost data\n", s);
+    exit(1);
+  }
+  for(i = BSIZE + 10; i < 3*BSIZE; i++){
+    if(buf[i] != 0){
+      printf("%s: byte %d not zero after ftruncate\n", s, i);
+      exit(1);
+    }
+  }
+
+  // a write past the end leaves a hole.
+  if(lseek(fd, 5*BSIZE, SEEK_SET) != 5*BSIZE || write(fd, "z", 1) != 1 ||
+     lseek(fd, -1, SEEK_CUR) != 5*BSIZE || lseek(fd, -1, SEEK_SET) != -1){
+    printf("%s: lseek failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, BSIZE, 4*BSIZE) != BSIZE){
+    printf("%s: read hole failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < BSIZE; i++){
+    if(buf[i] != 0){
+      printf("%s: hole not zero\n", s);
+      exit(1);
+    }
+  }
+
+  // fallocate() grows the file unless told not to.
+  if(fallocate(fd, FALLOC_FL_KEEP_SIZE, 8*BSIZE, BSIZE) != 0 ||
+     fstat(fd, &st) < 0 || st.size != 5*BSIZE + 1){
+    printf("%s: fallocate keep size failed\n", s);
+    exit(1);
+  }
+  if(fallocate(fd, 0, 3*BSIZE, 7*BSIZE) != 0 || fstat(fd, &st) < 0 ||
+     st.size != 10*BSIZE){
+    printf("%s: fallocate failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'q', BSIZE);
+  if(pwrite(fd, buf, BSIZE, 8*BSIZE) != BSIZE ||
+     pread(fd, buf, 3, 5*BSIZE - 1) != 3 || buf[0] != 0 || buf[1] != 'z' ||
+     buf[2] != 0){
+    printf("%s: write into fallocated blocks failed\n", s);
+    exit(1);
+  }
+  if(ftruncate(fd, 0) != 0 || fstat(fd, &st) < 0 || st.size != 0){
+    printf("%s: ftruncate to 0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("tf", O_RDONLY);
+  if(ftruncate(fd, 10) != -1 || fallocate(fd, 0, 0, 10) != -1){
+    printf("%s: ftruncate of a read-only fd\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  int fds[2];
+  pipe(fds);
+  if(lseek(fds[0], 0, SEEK_SET) != -1){
+    printf("%s: lseek on a pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("tf");
+}
+
+// with a commit interval set, operations share commits,
+// and fsync() forces one.
+void
+fsynctest(char *s)
+{
+  struct kstat st;
+  uint64 c0;
+  int fd, i, old;
+
+  old = sysctl(CTL_COMMIT, 1000);
+  kstat(&st);
+  c0 = st.commits;
+  fd = open("fsy", O_CREATE|O_RDWR);
+  for(i = 0; i < 10; i++){
+    if(write(fd, "0123456789", 10) != 10){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  kstat(&st);
+  if(st.commits - c0 >= 10){
+    printf("%s: %d commits for 11 ops\n", s, (int)(st.commits - c0));
+    exit(1);
+  }
+  c0 = st.commits;
+  if(fsync(fd) != 0 || fdatasync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  kstat(&st);
+  if(st.commits == c0){
+    printf("%s: fsync didn't commit\n", s);
+    exit(1);
+  }
+  sysctl(CTL_COMMIT, old);
+  close(fd);
+  unlink("fsy");
+
+  int fds[2];
+  pipe(fds);
+  if(fsync(fds[0]) != -1){
+    printf("%s: fsync of a pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// files in tmpfs, mounted on /tmp by init, and paths
+// that cross into and out of it.
+void
+tmpfstest(char *s)
+{
+  struct stat st;
+  int fd, i;
+
+  if(stat("/tmp", &st) < 0 || st.dev != TMPDEV || st.ino != ROOTINO){
+    printf("%s: /tmp is not tmpfs\n", s);
+    exit(1);
+  }
+  if(mkdir("/tmp/td") < 0 || (fd = open("/tmp/td/f", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create in /tmp failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*PGSIZE; i++)
+    buf[i] = i % 251;
+  if(pwrite(fd, buf, 3*PGSIZE, 100) != 3*PGSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(chdir("/tmp/td") < 0 || (fd = open("../td/f", O_RDONLY)) < 0){
+    printf("%s: relative path in /tmp failed\n", s);
+    exit(1);
+  }
+  memset(buf, 1, BUFSZ);
+  if(read(fd, buf, 3*PGSIZE + 200) != 3*PGSIZE + 100 || buf[0] != 0 ||
+     buf[99] != 0 || buf[100] != 0 || buf[101] != 1 ||
+     buf[100 + 3*PGSIZE - 1] != (3*PGSIZE - 1) % 251){
+    printf("%s: read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // back out through the mount point.
+  if(chdir("../..") < 0 || stat(".", &st) < 0 || st.dev != ROOTDEV ||
+     st.ino != ROOTINO){
+    printf("%s: .. out of /tmp failed\n", s);
+    exit(1);
+  }
+  if(link("/tmp/td/f", "tmplink") == 0 || unlink("/tmp") == 0){
+    printf("%s: link across devices or unlink of /tmp\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp/td") == 0 || unlink("/tmp/td/f") < 0 || unlink("/tmp/td") < 0){
+    printf("%s: unlink in /tmp failed\n", s);
+    exit(1);
+  }
+}
+
+// the second disk, when there is one, is a file system of
+// its own on /disk1, with its own log.
+void
+disk1test(char *s)
+{
+  struct stat st;
+  int fd, i;
+
+  if(stat("/disk1", &st) < 0 || st.dev != DISKDEV + 1){
+    printf("[no second disk] ");
+    return;
+  }
+  if(st.ino != ROOTINO || stat("/disk1/README", &st) < 0){
+    printf("%s: /disk1 is not the second disk\n", s);
+    exit(1);
+  }
+  if((fd = open("/disk1/d1f", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create on /disk1 failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 8*BSIZE; i++)
+    buf[i] = i % 253;
+  if(write(fd, buf, 8*BSIZE) != 8*BSIZE || fsync(fd) < 0){
+    printf("%s: write on /disk1 failed\n", s);
+    exit(1);
+  }
+  memset(buf, 0, 8*BSIZE);
+  if(pread(fd, buf, 8*BSIZE, 0) != 8*BSIZE || buf[BSIZE] != BSIZE % 253 ||
+     buf[8*BSIZE - 1] != (8*BSIZE - 1) % 253){
+    printf("%s: read back on /disk1 wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(link("/disk1/d1f", "d1link") == 0 || unlink("/disk1") == 0){
+    printf("%s: link across disks or unlink of /disk1\n", s);
+    exit(1);
+  }
+  if(unlink("/disk1/d1f") < 0){
+    printf("%s: unlink on /disk1 failed\n", s);
+    exit(1);
+  }
+
+  // leaving a removed cwd on /disk1 frees it there, in a
+  // transaction on that disk's log.
+  if(mkdir("/disk1/d1d") < 0 || chdir("/disk1/d1d") < 0 ||
+     unlink("/disk1/d1d") < 0){
+    printf("%s: mkdir, chdir or unlink on /disk1 failed\n", s);
+    exit(1);
+  }
+  if(chdir("/") < 0 || stat("/disk1/d1d", &st) == 0){
+    printf("%s: removed cwd on /disk1 still there\n", s);
+    exit(1);
+  }
+}
+
+// hold more inodes open at once than the inode table
+// used to have room for, then find them again.
+void
+manyinodes(char *s)
+{
+  enum { N = 100 };
+  int fds[N], i, fd;
+  char name[8];
+
+  name[0] = 'i';
+  name[4] = '\0';
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + (i / 10) % 10;
+    name[3] = '0' + i % 10;
+    fds[i] = open(name, O_CREATE|O_RDWR);
+    if(fds[i] < 0 || write(fds[i], &i, sizeof(i)) != sizeof(i)){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++)
+    close(fds[i]);
+
+  // again, now that they are unreferenced but cached.
+  for(i = 0; i < N; i++){
+    int x = -1;
+    name[1] = '0' + i / 100;
+    name[2] = '0' + (i / 10) % 10;
+    name[3] = '0' + i % 10;
+    fd = open(name, O_RDONLY);
+    if(fd < 0 || read(fd, &x, sizeof(x)) != sizeof(x) || x != i){
+      printf("%s: %s has %d\n", s, name, x);
+      exit(1);
+    }
+    close(fd);
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+}
+
+// names must come and go through the directory entry cache.
+void
+dcachetest(char *s)
+{
+  int fd, i;
+  char c;
+
+  for(i = 0; i < 3; i++){
+    if(open("dcd/f", O_RDONLY) >= 0){
+      printf("%s: dcd/f exists before it was made\n", s);
+      exit(1);
+    }
+    if(mkdir("dcd") < 0){
+      printf("%s: mkdir dcd failed\n", s);
+      exit(1);
+    }
+    if(open("dcd/f", O_RDONLY) >= 0){
+      printf("%s: dcd/f exists in a new dcd\n", s);
+      exit(1);
+    }
+    fd = open("dcd/f", O_CREATE|O_WRONLY);
+    if(fd < 0 || write(fd, "abc" + i, 1) != 1){
+      printf("%s: create dcd/f failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    fd = open("dcd/f", O_RDONLY);
+    if(fd < 0 || read(fd, &c, 1) != 1 || c != "abc"[i]){
+      printf("%s: dcd/f has the wrong contents\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(unlink("dcd/f") < 0 || unlink("dcd") < 0){
+      printf("%s: unlink dcd failed\n", s);
+      exit(1);
+    }
+  }
+}
+
 // many creates, followed by unlink test
 void
 createtest(char *s)
@@ -785,6 +1414,56 @@ pipe1(char *s)
   }
 }
 
+// epoll: readiness is reported once per edge.
+void
+epolltest(char *s)
+{
+  int ep, fds[2];
+  struct epoll_event ev, out[2];
+  char c;
+
+  if((ep = epoll_create()) < 0){
+    printf("%s: epoll_create failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  ev.events = EPOLLIN;
+  ev.data = 77;
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, fds[0], &ev) != 0){
+    printf("%s: epoll_ctl failed\n", s);
+    exit(1);
+  }
+  if(epoll_ctl(ep, EPOLL_CTL_ADD, fds[0], &ev) == 0){
+    printf("%s: duplicate epoll_ctl succeeded\n", s);
+    exit(1);
+  }
+  if(epoll_wait(ep, out, 2, 0) != 0){
+    printf("%s: empty pipe reported ready\n", s);
+    exit(1);
+  }
+  write(fds[1], "ab", 2);
+  if(epoll_wait(ep, out, 2, -1) != 1 || out[0].data != 77 ||
+     (out[0].events & EPOLLIN) == 0){
+    printf("%s: missing EPOLLIN\n", s);
+    exit(1);
+  }
+  // edge-triggered: no new event until new data arrives.
+  if(epoll_wait(ep, out, 2, 0) != 0){
+    printf("%s: event reported twice\n", s);
+    exit(1);
+  }
+  read(fds[0], &c, 1);
+  close(fds[1]);
+  if(epoll_wait(ep, out, 2, -1) != 1 || (out[0].events & EPOLLHUP) == 0){
+    printf("%s: missing EPOLLHUP\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(ep);
+}
 
 // test if child is killed (status = -1)
 void
@@ -1778,6 +2457,65 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// two interleaved sequential readers of a file bigger than
+// the buffer cache, one in odd-sized pieces, so that each
+// one's readahead recycles buffers the other wants.
+void
+readahead(char *s)
+{
+  enum { NB = 100, SZ = 700 };
+  int fd, fd1, fd2, i, j, n1, n2, off1, off2;
+  char buf2[SZ];
+
+  unlink("readahead.dat");
+  fd = open("readahead.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create readahead.dat\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NB; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write readahead.dat failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd1 = open("readahead.dat", 0);
+  fd2 = open("readahead.dat", 0);
+  if(fd1 < 0 || fd2 < 0){
+    printf("%s: cannot open readahead.dat\n", s);
+    exit(1);
+  }
+  off1 = off2 = 0;
+  do {
+    n1 = read(fd1, buf, BSIZE);
+    for(j = 0; j < n1; j++){
+      if((uchar)buf[j] != (off1 + j) / BSIZE){
+        printf("%s: wrong data at %d\n", s, off1 + j);
+        exit(1);
+      }
+    }
+    off1 += n1 > 0 ? n1 : 0;
+    n2 = read(fd2, buf2, SZ);
+    for(j = 0; j < n2; j++){
+      if((uchar)buf2[j] != (off2 + j) / BSIZE){
+        printf("%s: wrong data at %d\n", s, off2 + j);
+        exit(1);
+      }
+    }
+    off2 += n2 > 0 ? n2 : 0;
+  } while(n1 > 0 || n2 > 0);
+  close(fd1);
+  close(fd2);
+  if(off1 != NB*BSIZE || off2 != NB*BSIZE){
+    printf("%s: short read %d %d\n", s, off1, off2);
+    exit(1);
+  }
+  unlink("readahead.dat");
+}
+
 void
 fourteen(char *s)
 {
@@ -2590,10 +3328,21 @@ struct test {
   {opentest, "opentest"},
   {writetest, "writetest"},
   {writebig, "writebig"},
+  {extentfile, "extentfile"},
+  {delalloc, "delalloc"},
+  {inlinefile, "inlinefile"},
+  {preadv, "preadv"},
+  {truncfile, "truncfile"},
+  {fsynctest, "fsynctest"},
+  {tmpfstest, "tmpfstest"},
+  {disk1test, "disk1test"},
+  {manyinodes, "manyinodes"},
+  {dcachetest, "dcachetest"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {epolltest, "epolltest"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2613,6 +3362,7 @@ struct test {
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
   {bigfile, "bigfile"},
+  {readahead, "readahead"},
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
@@ -37,3 +37,18 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("lock");
+entry("epoll_create");
+entry("epoll_ctl");
+entry("epoll_wait");
+entry("kstat");
+entry("sysctl");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("lseek");
+entry("ftruncate");
+entry("fallocate");
+entry("fsync");
+entry("fdatasync");
+entry("mount");